@@ -0,0 +1,543 @@
+//
+// Latency/throughput benchmarks of the utils primitives.
+//
+// - Every sample is a TSC delta recorded into a Histogram, reported as one JSON object per line (or a table
+//   with --text), so that results of two releases can be diffed.
+// - Threads are pinned with --cpus in order (measuring thread first), e.g. --cpus 2,3 for two cores of the
+//   same socket, --cpus 2,2 for the same core.
+//
+#include "Event.hxx"
+#include "FdAggregator.hxx"
+#include "Histogram.hxx"
+#include "InlineVector.hxx"
+#include "LockFreeEvent.hxx"
+#include "Logger.hxx"
+#include "MPMCRingBuffer.hxx"
+#include "MPMCSeqRingBuffer.hxx"
+#include "Reactor.hxx"
+#include "SPSCRingBuffer.hxx"
+#include "ShmRingBuffer.hxx"
+#include "ThreadFactory.hxx"
+#include "Tsc.hxx"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace leopard::utils;
+
+struct Options
+{
+    std::string _filter;
+    uint64_t _iterations{200000};
+    std::vector<int> _cpus;
+    bool _text{false};
+};
+
+Options gOptions;
+double gNsPerTick{1.0};
+
+uint64_t ToNs(uint64_t ticks)
+{
+    return static_cast<uint64_t>(ticks * gNsPerTick);
+}
+
+// Attributes of the index-th thread of a benchmark.
+ThreadAttributes GetAttributes(std::size_t index)
+{
+    ThreadAttributes attributes;
+    if (!gOptions._cpus.empty())
+    {
+        attributes._cpus = {gOptions._cpus[index % gOptions._cpus.size()]};
+    }
+    attributes._name = std::string("bench") + std::to_string(index);
+    return attributes;
+}
+
+std::string GetPlacement(std::size_t thread_number)
+{
+    if (gOptions._cpus.empty())
+    {
+        return "any";
+    }
+    std::string placement;
+    for (std::size_t i = 0; i < thread_number; ++i)
+    {
+        placement.append(i ? "," : "").append(std::to_string(gOptions._cpus[i % gOptions._cpus.size()]));
+    }
+    return placement;
+}
+
+// Busy-wait step, yields once in a while so that it also makes progress with fewer cores than threads.
+inline void Relax(uint32_t &spins)
+{
+    if (++spins < 1024)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+    {
+        spins = 0;
+        std::this_thread::yield();
+    }
+}
+
+bool IsSelected(const std::string &name)
+{
+    return gOptions._filter.empty() || (name.find(gOptions._filter) != std::string::npos);
+}
+
+void Report(const std::string &name, const std::string &config, const Histogram &histogram, double ops_per_sec)
+{
+    if (gOptions._text)
+    {
+        printf("%-28s %-18s %10llu %8llu %8llu %8llu %8llu %10llu %14.0f\n", name.c_str(), config.c_str(),
+               static_cast<unsigned long long>(histogram.GetCount()),
+               static_cast<unsigned long long>(histogram.GetMin()),
+               static_cast<unsigned long long>(histogram.GetPercentile(50)),
+               static_cast<unsigned long long>(histogram.GetPercentile(99)),
+               static_cast<unsigned long long>(histogram.GetPercentile(99.9)),
+               static_cast<unsigned long long>(histogram.GetMax()), ops_per_sec);
+    }
+    else
+    {
+        printf("{\"benchmark\":\"%s\",\"config\":\"%s\",\"count\":%llu,\"min_ns\":%llu,\"mean_ns\":%.1f,\"p50_ns\":%llu,"
+               "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"ops_per_sec\":%.0f}\n", name.c_str(), config.c_str(),
+               static_cast<unsigned long long>(histogram.GetCount()),
+               static_cast<unsigned long long>(histogram.GetMin()), histogram.GetMean(),
+               static_cast<unsigned long long>(histogram.GetPercentile(50)),
+               static_cast<unsigned long long>(histogram.GetPercentile(99)),
+               static_cast<unsigned long long>(histogram.GetPercentile(99.9)),
+               static_cast<unsigned long long>(histogram.GetMax()), ops_per_sec);
+    }
+    fflush(stdout);
+}
+
+struct BenchMessage
+{
+    std::size_t _seq{0};
+    InlineVector<const char*, 1> _data_pointers; // Required by MPMCRingBuffer.
+    uint64_t _tick{0};
+};
+
+// ShmRingBuffer needs a trivially copyable message.
+struct ShmBenchMessage
+{
+    uint64_t _tick{0};
+};
+
+constexpr std::size_t RING_CAPACITY{1024};
+
+template <typename Ring>
+void InitRing(Ring &ring)
+{
+    ring.Init(RING_CAPACITY);
+}
+
+template <typename T, std::size_t Capacity>
+void InitRing(SPSCRingBuffer<T, Capacity>&)
+{
+}
+
+// Created and removed right away, the mapping stays valid and nothing is left in /dev/shm.
+template <typename T>
+void InitRing(ShmRingBuffer<T> &ring)
+{
+    static uint32_t counter{0};
+    auto name = "bench_utils_" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+    if (!ring.Create(name, RING_CAPACITY))
+    {
+        throw std::runtime_error("Failed to create shared memory ring " + name);
+    }
+    ShmRingBuffer<T>::Remove(name);
+}
+
+template <typename Ring, typename Fill>
+void Push(Ring &ring, Fill &&fill)
+{
+    uint32_t spins = 0;
+    decltype(ring.GetMessageForWrite()) msg;
+    while (!(msg = ring.GetMessageForWrite()))
+    {
+        Relax(spins);
+    }
+    fill(*msg);
+    ring.CommitMessageWrite(msg);
+}
+
+template <typename Ring>
+auto Pop(Ring &ring)
+{
+    uint32_t spins = 0;
+    decltype(ring.GetMessageForRead()) msg;
+    while (!(msg = ring.GetMessageForRead()))
+    {
+        Relax(spins);
+    }
+    auto copy = *msg;
+    ring.CommitMessageRead(msg);
+    return copy;
+}
+
+// The TSC read itself, the floor of every other result.
+void BenchTscOverhead()
+{
+    if (!IsSelected("tsc_overhead"))
+    {
+        return;
+    }
+    Histogram histogram;
+    for (uint64_t i = 0; i < gOptions._iterations; ++i)
+    {
+        auto start = Tsc::Now();
+        histogram.Record(ToNs(Tsc::Now() - start));
+    }
+    Report("tsc_overhead", "1t", histogram, 0);
+}
+
+// Ping-pong through two rings, one message in flight.
+template <typename Ring>
+void BenchRingRoundTrip(const std::string &name)
+{
+    if (!IsSelected(name))
+    {
+        return;
+    }
+    Ring ping;
+    Ring pong;
+    InitRing(ping);
+    InitRing(pong);
+
+    auto echo = ThreadFactory::Create(GetAttributes(1), [&](){
+        for (uint64_t i = 0; i < gOptions._iterations; ++i)
+        {
+            auto msg = Pop(ping);
+            Push(pong, [&msg](auto &m){ m._tick = msg._tick; });
+        }
+    });
+
+    Histogram histogram;
+    uint64_t total_ticks = 0;
+    ThreadFactory::Create(GetAttributes(0), [&](){
+        auto begin = Tsc::Now();
+        for (uint64_t i = 0; i < gOptions._iterations; ++i)
+        {
+            Push(ping, [](auto &m){ m._tick = Tsc::Now(); });
+            auto msg = Pop(pong);
+            histogram.Record(ToNs(Tsc::Now() - msg._tick));
+        }
+        total_ticks = Tsc::Now() - begin;
+    }).join();
+    echo.join();
+
+    Report(name, "1p1c@" + GetPlacement(2), histogram, gOptions._iterations / (ToNs(total_ticks) / 1e9));
+}
+
+// Producers stamp the messages, consumers record the time to dequeue them; throughput of all the threads.
+template <typename Ring>
+void BenchRingThroughput(const std::string &name, uint32_t producer_number, uint32_t consumer_number)
+{
+    if (!IsSelected(name))
+    {
+        return;
+    }
+    Ring ring;
+    InitRing(ring);
+
+    auto per_producer = gOptions._iterations / producer_number;
+    auto total = per_producer * producer_number;
+    std::atomic<uint64_t> consumed{0};
+    std::atomic<uint32_t> ready{0};
+    std::vector<Histogram> histograms(consumer_number);
+    std::vector<std::thread> threads;
+    auto thread_number = producer_number + consumer_number;
+
+    uint64_t begin = 0;
+    for (uint32_t c = 0; c < consumer_number; ++c)
+    {
+        threads.push_back(ThreadFactory::Create(GetAttributes(c), [&, c](){
+            if (++ready == thread_number)
+            {
+                begin = Tsc::Now();
+            }
+            uint32_t spins = 0;
+            while (consumed.load(std::memory_order_relaxed) < total)
+            {
+                auto *msg = ring.GetMessageForRead();
+                if (!msg)
+                {
+                    Relax(spins);
+                    continue;
+                }
+                histograms[c].Record(ToNs(Tsc::Now() - msg->_tick));
+                ring.CommitMessageRead(msg);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }));
+    }
+    for (uint32_t p = 0; p < producer_number; ++p)
+    {
+        threads.push_back(ThreadFactory::Create(GetAttributes(consumer_number + p), [&, p](){
+            if (++ready == thread_number)
+            {
+                begin = Tsc::Now();
+            }
+            for (uint64_t i = 0; i < per_producer; ++i)
+            {
+                Push(ring, [](auto &m){ m._tick = Tsc::Now(); });
+            }
+        }));
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    auto elapsed_ns = ToNs(Tsc::Now() - begin);
+
+    Histogram histogram;
+    for (auto &h : histograms)
+    {
+        histogram.Merge(h);
+    }
+    Report(name, std::to_string(producer_number) + "p" + std::to_string(consumer_number) + "c@" + GetPlacement(thread_number),
+           histogram, total / (elapsed_ns / 1e9));
+}
+
+// Cost of one Notify() to a number of observers.
+template <typename EventType>
+void BenchNotify(const std::string &name, uint32_t observer_number)
+{
+    if (!IsSelected(name))
+    {
+        return;
+    }
+    EventType event;
+    uint64_t sink = 0;
+    for (uint32_t i = 0; i < observer_number; ++i)
+    {
+        event.Connect([&sink](uint64_t v){ sink += v; });
+    }
+
+    Histogram histogram;
+    uint64_t total_ticks = 0;
+    for (uint64_t i = 0; i < gOptions._iterations; ++i)
+    {
+        auto start = Tsc::Now();
+        event.Notify(i);
+        auto ticks = Tsc::Now() - start;
+        total_ticks += ticks;
+        histogram.Record(ToNs(ticks));
+    }
+    if (sink == 0)
+    {
+        printf("Unexpected sink\n");
+    }
+    Report(name, std::to_string(observer_number) + "_observers", histogram, gOptions._iterations / (ToNs(total_ticks) / 1e9));
+}
+
+// Time from a write to an fd on one thread to the callback on a busy-polling reactor, one event in flight.
+void BenchReactorDispatch(const std::string &name, int read_fd, int write_fd, bool datagram)
+{
+    if (!IsSelected(name))
+    {
+        return;
+    }
+    // The callback only captures this, the fd callbacks have a small inline storage.
+    struct State
+    {
+        int _read_fd{-1};
+        bool _datagram{false};
+        Histogram _histogram;
+        std::atomic<uint64_t> _handled{0};
+        std::atomic<uint64_t> _stamp{0};
+    } state;
+    state._read_fd = read_fd;
+    state._datagram = datagram;
+
+    Reactor<FdAggregator> reactor;
+    reactor.AddFd(read_fd, EPOLLIN, [&state](){
+        uint64_t tick;
+        if (read(state._read_fd, &tick, sizeof(tick)) != static_cast<ssize_t>(sizeof(tick)))
+        {
+            return;
+        }
+        // An eventfd carries a counter, so the stamp is passed aside.
+        state._histogram.Record(ToNs(Tsc::Now() - (state._datagram ? tick : state._stamp.load(std::memory_order_acquire))));
+        state._handled.fetch_add(1, std::memory_order_release);
+    }, [](){});
+
+    auto t = ThreadFactory::Create(GetAttributes(1), &Reactor<FdAggregator>::Run, &reactor);
+    uint64_t total_ticks = 0;
+    ThreadFactory::Create(GetAttributes(0), [&](){
+        auto begin = Tsc::Now();
+        for (uint64_t i = 0; i < gOptions._iterations; ++i)
+        {
+            uint64_t tick = Tsc::Now();
+            state._stamp.store(tick, std::memory_order_release);
+            uint64_t value = datagram ? tick : 1;
+            if (write(write_fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value)))
+            {
+                break;
+            }
+            uint32_t spins = 0;
+            while (state._handled.load(std::memory_order_acquire) <= i)
+            {
+                Relax(spins);
+            }
+        }
+        total_ticks = Tsc::Now() - begin;
+    }).join();
+    reactor.Stop();
+    t.join();
+
+    Report(name, "1w1r@" + GetPlacement(2), state._histogram, state._histogram.GetCount() / (ToNs(total_ticks) / 1e9));
+}
+
+void BenchReactorEventfd()
+{
+    auto efd = eventfd(0, EFD_NONBLOCK);
+    BenchReactorDispatch("reactor_eventfd", efd, efd, false);
+    close(efd);
+}
+
+void BenchReactorUdp()
+{
+    auto receiver = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    auto sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if ((bind(receiver, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0)
+        && (getsockname(receiver, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0)
+        && (connect(sender, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0))
+    {
+        BenchReactorDispatch("reactor_udp_loopback", receiver, sender, true);
+    }
+    else
+    {
+        fprintf(stderr, "Failed to set up loopback UDP sockets: %s\n", strerror(errno));
+    }
+    close(receiver);
+    close(sender);
+}
+
+std::vector<int> ParseCpus(const char *list)
+{
+    std::vector<int> cpus;
+    for (const char *p = list; *p; )
+    {
+        char *end;
+        cpus.push_back(static_cast<int>(strtol(p, &end, 10)));
+        p = (*end == ',') ? end + 1 : end;
+        if (end == p)
+        {
+            break;
+        }
+    }
+    return cpus;
+}
+
+void Usage(const char *program)
+{
+    printf("Usage: %s [--filter <substring>] [--iterations <n>] [--cpus <cpu,cpu,...>] [--text]\n"
+           "  --filter      Only run the benchmarks whose name contains the substring.\n"
+           "  --iterations  Samples per benchmark (default %llu).\n"
+           "  --cpus        Pin the threads of each benchmark to these CPUs in order, measuring thread first.\n"
+           "  --text        Print a table instead of one JSON object per benchmark.\n",
+           program, static_cast<unsigned long long>(Options()._iterations));
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        if ((arg == "--filter") && (i + 1 < argc))
+        {
+            gOptions._filter = argv[++i];
+        }
+        else if ((arg == "--iterations") && (i + 1 < argc))
+        {
+            gOptions._iterations = std::max(1ULL, strtoull(argv[++i], nullptr, 10));
+        }
+        else if ((arg == "--cpus") && (i + 1 < argc))
+        {
+            gOptions._cpus = ParseCpus(argv[++i]);
+        }
+        else if (arg == "--text")
+        {
+            gOptions._text = true;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // The logger isn't started, so records go synchronously to stdout: keep the set-up INFO lines out of the
+    // results.
+    Logger::GetInstance().SetLevel(LogLevel::warn);
+
+    gNsPerTick = Tsc::Calibrate(100000000);
+    if (gOptions._text)
+    {
+        printf("%-28s %-18s %10s %8s %8s %8s %8s %10s %14s\n", "benchmark", "config", "count", "min_ns", "p50_ns",
+               "p99_ns", "p999_ns", "max_ns", "ops_per_sec");
+    }
+
+    try
+    {
+        BenchTscOverhead();
+
+        BenchRingRoundTrip<MPMCRingBuffer<BenchMessage>>("mpmc_ring_rtt");
+        BenchRingRoundTrip<MPMCSeqRingBuffer<BenchMessage>>("mpmc_seq_ring_rtt");
+        BenchRingRoundTrip<SPSCRingBuffer<BenchMessage, RING_CAPACITY>>("spsc_ring_rtt");
+        BenchRingRoundTrip<ShmRingBuffer<ShmBenchMessage>>("shm_ring_rtt");
+
+        BenchRingThroughput<MPMCRingBuffer<BenchMessage>>("mpmc_ring_throughput", 1, 1);
+        BenchRingThroughput<MPMCRingBuffer<BenchMessage>>("mpmc_ring_throughput", 2, 2);
+        BenchRingThroughput<MPMCRingBuffer<BenchMessage>>("mpmc_ring_throughput", 4, 4);
+        BenchRingThroughput<MPMCSeqRingBuffer<BenchMessage>>("mpmc_seq_ring_throughput", 1, 1);
+        BenchRingThroughput<MPMCSeqRingBuffer<BenchMessage>>("mpmc_seq_ring_throughput", 2, 2);
+        BenchRingThroughput<MPMCSeqRingBuffer<BenchMessage>>("mpmc_seq_ring_throughput", 4, 4);
+        BenchRingThroughput<SPSCRingBuffer<BenchMessage, RING_CAPACITY>>("spsc_ring_throughput", 1, 1);
+        BenchRingThroughput<ShmRingBuffer<ShmBenchMessage>>("shm_ring_throughput", 1, 1);
+        BenchRingThroughput<ShmRingBuffer<ShmBenchMessage>>("shm_ring_throughput", 2, 2);
+        BenchRingThroughput<ShmRingBuffer<ShmBenchMessage>>("shm_ring_throughput", 4, 4);
+
+        for (uint32_t observers : {1, 4, 16})
+        {
+            BenchNotify<Event<std::function<void(uint64_t)>>>("event_notify", observers);
+            BenchNotify<LockFreeEvent<void(uint64_t)>>("lock_free_event_notify", observers);
+        }
+
+        BenchReactorEventfd();
+        BenchReactorUdp();
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "Benchmark failed: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
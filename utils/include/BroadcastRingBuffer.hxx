@@ -0,0 +1,223 @@
+#ifndef LEOPARD_UTILS_BROADCASTRINGBUFFER_HXX_
+#define LEOPARD_UTILS_BROADCASTRINGBUFFER_HXX_
+
+#include <Common.hxx>
+#include <Logger.hxx>
+#include <Math.hxx>
+#include <NonCopyable.hxx>
+
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+//
+// - Multi-producer ring-buffer where every message is delivered to every registered consumer (Disruptor style).
+// - Same slot layout and Get/Commit interface as MPMCRingBuffer, consumers read the slots in place (zero-copy).
+// - Each consumer owns a read cursor and must be driven by a single thread. Producers are gated by the slowest cursor.
+// - A consumer may depend on other consumers, then it only sees a message after all of them have committed it.
+// - Consumers should be registered before any message is written.
+//
+template <typename T>
+class BroadcastRingBuffer : private NonCopyable
+{
+public:
+    static constexpr std::size_t MAX_CONSUMERS{16};
+
+    /**
+    * Initialize the ring-buffer to a certain capacity (num of slots) based on a suggested value.
+    *
+    * @param capacity Suggested ring-buffer capacity. It will be rounded to the power of 2 upwards to apply.
+    * @return True if the ring-buffer is initialized successfully, false if it has already been initialized.
+    */
+    bool Init(std::size_t capacity)
+    {
+        std::size_t expected = 0;
+        auto actual_capacity = Math::NextPowerOf2(capacity);
+
+        if (!_capacity.compare_exchange_strong(expected, actual_capacity))
+        {
+            LEOPARD_LOG_WARN("Buffer already initialized: capacity={}", _capacity.load(std::memory_order_acquire));
+            return false;
+        }
+
+        _slots.reset(new Slot[actual_capacity]);
+        _mask = actual_capacity - 1;
+        std::atomic_thread_fence(std::memory_order_release);
+        LEOPARD_LOG_INFO("Buffer initialized: capacity={}", _capacity.load(std::memory_order_acquire));
+        return true;
+    }
+
+    /**
+    * Get the ring-buffer capacity.
+    *
+    * @return Current capcacity of the ring-buffer.
+    */
+    std::size_t GetCapacity()
+    {
+        return _capacity.load(std::memory_order_acquire);
+    }
+
+    /**
+    * Register a consumer. NOT thread safe, call it before producers and consumers start.
+    *
+    * @param dependencies Ids of the consumers that must have committed a message before this one can read it.
+    * @return Id of the new consumer.
+    */
+    std::size_t AddConsumer(std::initializer_list<std::size_t> dependencies = {})
+    {
+        if (_consumer_number >= MAX_CONSUMERS)
+        {
+            throw std::logic_error("Too many consumers registered to BroadcastRingBuffer.");
+        }
+        for (auto dep : dependencies)
+        {
+            if (dep >= _consumer_number)
+            {
+                throw std::logic_error("Consumer dependency must be registered before the dependent consumer.");
+            }
+        }
+
+        auto &cursor = _cursors[_consumer_number];
+        cursor._dependencies.assign(dependencies);
+        cursor._seq.store(_write_reserve_count.load(std::memory_order_acquire), std::memory_order_release);
+        return _consumer_number++;
+    }
+
+    /**
+    * Get current message count in the ring-buffer that the consumer has not read yet.
+    *
+    * @param consumer Id of the consumer.
+    * @return Number of slots reserved by producers but not yet committed by the consumer.
+    */
+    std::size_t GetMessageNumber(std::size_t consumer)
+    {
+        auto read_ctr_snapshot = _cursors[consumer]._seq.load(std::memory_order_acquire);
+        return _write_reserve_count.load(std::memory_order_acquire) - read_ctr_snapshot;
+    }
+
+    /**
+    * Try to get a ring-buffer slot for equeuing a message.
+    *
+    * @return Pointer to the available ring-buffer slot if the queue is not full, nullptr otherwise.
+    */
+    T* GetMessageForWrite()
+    {
+        auto write_ctr_snapshot = _write_reserve_count.load(std::memory_order_acquire);
+
+        do
+        {
+            if (UNLIKELY(IsFull(write_ctr_snapshot, _gating_count.load(std::memory_order_relaxed))))
+            {
+                // Only scan the consumer cursors when the cached slowest cursor says the buffer is full.
+                auto read_ctr_snapshot = GetSlowestCursor(write_ctr_snapshot);
+                _gating_count.store(read_ctr_snapshot, std::memory_order_relaxed);
+                if (IsFull(write_ctr_snapshot, read_ctr_snapshot))
+                {
+                    return nullptr;
+                }
+            }
+        }
+        while (!_write_reserve_count.compare_exchange_weak(write_ctr_snapshot, write_ctr_snapshot + 1, std::memory_order_release));
+
+        T *rst = &_slots[write_ctr_snapshot & _mask]._msg;
+        rst->_seq = write_ctr_snapshot;
+        rst->_data_pointers.resize(0);
+        return rst;
+    }
+
+    /**
+    * Commit enqueuing a message to the ring-buffer. Doesn't wait for other producers to commit.
+    *
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageWrite(const T *msg)
+    {
+        _slots[msg->_seq & _mask]._published.store(msg->_seq + 1, std::memory_order_release);
+    }
+
+    /**
+    * Try to read the next message for a consumer.
+    *
+    * @param consumer Id of the consumer.
+    * @return Pointer to the next message of the consumer if it is ready, nullptr otherwise.
+    */
+    const T* GetMessageForRead(std::size_t consumer)
+    {
+        auto &cursor = _cursors[consumer];
+        auto read_ctr = cursor._seq.load(std::memory_order_relaxed);
+        auto &slot = _slots[read_ctr & _mask];
+
+        if (slot._published.load(std::memory_order_acquire) != read_ctr + 1)
+        {
+            return nullptr;
+        }
+        for (auto dep : cursor._dependencies)
+        {
+            if (_cursors[dep]._seq.load(std::memory_order_acquire) <= read_ctr)
+            {
+                return nullptr;
+            }
+        }
+        return &slot._msg;
+    }
+
+    /**
+    * Commit reading a message for a consumer, the slot is released once all consumers have committed it.
+    *
+    * @param consumer Id of the consumer.
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageRead(std::size_t consumer, const T *msg)
+    {
+        _cursors[consumer]._seq.store(msg->_seq + 1, std::memory_order_release);
+    }
+
+private:
+    struct Slot
+    {
+        // Seq of the message + 1 once it is committed by its producer.
+        std::atomic<std::size_t> _published{0};
+        T _msg;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Cursor
+    {
+        // Seq of the next message to read.
+        std::atomic<std::size_t> _seq{0};
+        std::vector<std::size_t> _dependencies;
+    };
+
+    ALWAYS_INLINE bool IsFull(std::size_t writeCtr, std::size_t readCtr)
+    {
+        // Note: readCtr may be stale (smaller than the real slowest cursor), so use ">=" here.
+        return writeCtr - readCtr >= _mask + 1;
+    }
+
+    std::size_t GetSlowestCursor(std::size_t writeCtr)
+    {
+        auto rst = writeCtr;
+        for (std::size_t i = 0; i < _consumer_number; ++i)
+        {
+            auto seq = _cursors[i]._seq.load(std::memory_order_acquire);
+            rst = seq < rst ? seq : rst;
+        }
+        return rst;
+    }
+
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask{0};
+    std::atomic<std::size_t> _capacity{0};
+    std::size_t _consumer_number{0};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write_reserve_count{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _gating_count{0};
+    Cursor _cursors[MAX_CONSUMERS];
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_BROADCASTRINGBUFFER_HXX_
\ No newline at end of file
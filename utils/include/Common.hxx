@@ -16,4 +16,8 @@
     #define UNLIKELY(x) (x)
 #endif
 
+// Size of a cache line on the platforms we target, used to pad shared atomics
+// onto their own lines and so avoid false sharing between threads.
+#define CACHE_LINE_SIZE 64
+
 #endif // LEOPARD_UTILS_COMMON_HXX_
\ No newline at end of file
@@ -0,0 +1,171 @@
+#ifndef LEOPARD_UTILS_DELEGATE_HXX_
+#define LEOPARD_UTILS_DELEGATE_HXX_
+
+#include <Common.hxx>
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace leopard { namespace utils {
+
+template <typename Signature, std::size_t Size = 4 * sizeof(void*)>
+class Delegate;
+
+//
+// - Type-erased callable like std::function, but the callable is always stored inline in a fixed-size buffer.
+//   Constructing, copying and invoking never allocate; a callable larger than the buffer fails to compile.
+// - Trivially copyable callables (function pointers, lambdas capturing pointers/PODs) are copied with memcpy.
+//
+template <typename R, typename... Args, std::size_t Size>
+class Delegate<R(Args...), Size>
+{
+public:
+    Delegate() = default;
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+    Delegate(F &&f)
+    {
+        using Functor = typename std::decay<F>::type;
+        static_assert(sizeof(Functor) <= Size, "Callable is too large for Delegate, capture less or increase the Size.");
+        static_assert(alignof(Functor) <= alignof(std::max_align_t), "Callable is over-aligned for Delegate.");
+
+        new (_storage) Functor(std::forward<F>(f));
+        _invoke = &Invoke<Functor>;
+        if (!(std::is_trivially_copyable<Functor>::value && std::is_trivially_destructible<Functor>::value))
+        {
+            _manage = &Manage<Functor>;
+        }
+    }
+
+    Delegate(const Delegate &other)
+    {
+        CopyFrom(other);
+    }
+
+    Delegate(Delegate &&other) noexcept
+    {
+        MoveFrom(std::move(other));
+    }
+
+    Delegate& operator = (const Delegate &other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            CopyFrom(other);
+        }
+        return *this;
+    }
+
+    Delegate& operator = (Delegate &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            MoveFrom(std::move(other));
+        }
+        return *this;
+    }
+
+    ~Delegate()
+    {
+        Reset();
+    }
+
+    /**
+    * Invoke the stored callable. The delegate must not be empty.
+    */
+    ALWAYS_INLINE R operator()(Args... args) const
+    {
+        return _invoke(const_cast<unsigned char*>(_storage), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return _invoke != nullptr;
+    }
+
+    void Reset()
+    {
+        if (_manage)
+        {
+            _manage(Operation::destroy, _storage, nullptr);
+        }
+        _invoke = nullptr;
+        _manage = nullptr;
+    }
+
+private:
+    enum class Operation
+    {
+        copy, move, destroy
+    };
+
+    using Invoker = R (*)(void*, Args...);
+    using Manager = void (*)(Operation, void*, void*);
+
+    template <typename Functor>
+    static R Invoke(void *storage, Args... args)
+    {
+        return (*static_cast<Functor*>(storage))(std::forward<Args>(args)...);
+    }
+
+    template <typename Functor>
+    static void Manage(Operation op, void *dst, void *src)
+    {
+        switch (op)
+        {
+            case Operation::copy:
+                new (dst) Functor(*static_cast<const Functor*>(src));
+                break;
+            case Operation::move:
+                new (dst) Functor(std::move(*static_cast<Functor*>(src)));
+                static_cast<Functor*>(src)->~Functor();
+                break;
+            case Operation::destroy:
+                static_cast<Functor*>(dst)->~Functor();
+                break;
+        }
+    }
+
+    void CopyFrom(const Delegate &other)
+    {
+        if (other._manage)
+        {
+            other._manage(Operation::copy, _storage, const_cast<unsigned char*>(other._storage));
+        }
+        else if (other._invoke)
+        {
+            std::memcpy(_storage, other._storage, Size);
+        }
+        _invoke = other._invoke;
+        _manage = other._manage;
+    }
+
+    void MoveFrom(Delegate &&other)
+    {
+        if (other._manage)
+        {
+            other._manage(Operation::move, _storage, other._storage);
+        }
+        else if (other._invoke)
+        {
+            std::memcpy(_storage, other._storage, Size);
+        }
+        _invoke = other._invoke;
+        _manage = other._manage;
+        other._invoke = nullptr;
+        other._manage = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char _storage[Size]{};
+    Invoker _invoke{nullptr};
+    Manager _manage{nullptr};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_DELEGATE_HXX_
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define LEOPARD_UTILS_EVENT_HXX_
 
 #include "NonCopyable.hxx"
+#include <map>
 #include <mutex>
 
 namespace leopard { namespace utils {
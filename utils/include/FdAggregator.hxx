@@ -1,12 +1,25 @@
 #ifndef LEOPARD_UTILS_FDAGGREGATOR_HXX_
 #define LEOPARD_UTILS_FDAGGREGATOR_HXX_
 
+#include "Delegate.hxx"
+#include "Logger.hxx"
+
 #include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
 #include <atomic>
+#include <climits>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <system_error>
+#include <vector>
 
 namespace leopard { namespace utils {
 
+class FdAggregator;
+
 class FdEventHandler
 {
 public:
@@ -22,11 +35,21 @@ public:
         return _fd;
     }
 
+    // Only called once when the handler is added to FdAggregator, not per event.
     virtual HandlerFunc GetHandlerFunc() = 0;
     virtual ErrorFunc GetErrorFunc() = 0;
 
+protected:
+    /**
+    * Remove the fd from the aggregator it was added to, if any and still alive. Call it before closing the fd.
+    */
+    void RemoveFromAggregator();
+
 private:
+    friend class FdAggregator;
+
     int _fd{0};
+    FdAggregator *_aggregator{nullptr};
 };
 
 class FdAggregator
@@ -34,6 +57,10 @@ class FdAggregator
 public:
     static constexpr uint32_t MAX_EPOLL_EVENTS{1024};
 
+    // Stored once per fd when it is added, dispatching an event never allocates. A legacy
+    // FdEventHandler's std::function fits into it as well.
+    using Callback = Delegate<void(), sizeof(std::function<void()>)>;
+
     FdAggregator()
     {
         _epoll_fd = epoll_create1(0);
@@ -43,21 +70,160 @@ public:
         }
     }
 
-    bool AddFd(int fd, uint32_t events, FdEventHandler *handler)
+    ~FdAggregator()
+    {
+        // The handlers still added must not remove their fd from a destroyed aggregator.
+        for (auto &entry : _entries)
+        {
+            if (entry && entry->_handler)
+            {
+                entry->_handler->_aggregator = nullptr;
+            }
+        }
+        close(_epoll_fd);
+    }
+
+    /**
+    * Add a fd with the callbacks to run on its events.
+    *
+    * @param fd The fd to poll.
+    * @param events Epoll events to poll, e.g. EPOLLIN|EPOLLOUT|EPOLLET.
+    * @param on_read Called when the fd is readable.
+    * @param on_error Called when an error/hang-up is detected, the fd has been removed from the aggregator by then.
+    * @param on_write Called when the fd is writable, can be empty if EPOLLOUT is not polled.
+    * @return True if the fd is added successfully, false otherwise. A fd closed without RemoveFd() can be added
+    *         again once its number is reused.
+    */
+    bool AddFd(int fd, uint32_t events, Callback on_read, Callback on_error, Callback on_write = Callback())
     {
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (static_cast<std::size_t>(fd) >= _entries.size())
+        {
+            _entries.resize(fd + 1);
+        }
+
+        // Still active, either the fd is added already (epoll tells) or it was closed without RemoveFd() and
+        // the entry is stale. Also replaced when re-added from its own callback, which stays in the old entry
+        // until it returns.
+        auto &slot = _entries[fd];
+        std::unique_ptr<FdEntry> fresh;
+        if (!slot || slot->_active || (slot.get() == _dispatching))
+        {
+            fresh.reset(new FdEntry());
+        }
+        auto *entry = fresh ? fresh.get() : slot.get();
+
         struct epoll_event ep_event;
-        ep_event.data.ptr = handler;
+        ep_event.data.ptr = entry;
         ep_event.events = events;
         if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ep_event) == -1)
         {
-            std::cout << "Failed to add fd to aggregator: fd=" << fd << ", errno=" << errno << ", err_text=" << strerror(errno) << std::endl;
+            if (errno == EEXIST)
+            {
+                LEOPARD_LOG_WARN("Failed to add fd to aggregator as it is already added: fd={}", fd);
+            }
+            else
+            {
+                LEOPARD_LOG_ERROR("Failed to add fd to aggregator: fd={}, errno={}, err_text={}", fd, errno, strerror(errno));
+            }
+            return false;
+        }
+
+        if (fresh)
+        {
+            if (slot)
+            {
+                // Events of this batch may still point to it.
+                Deactivate(slot.get());
+                _retired.push_back(std::move(slot));
+            }
+            slot = std::move(fresh);
+        }
+
+        entry->_fd = fd;
+        entry->_active = true;
+        entry->_on_read = std::move(on_read);
+        entry->_on_write = std::move(on_write);
+        entry->_on_error = std::move(on_error);
+        return true;
+    }
+
+    bool AddFd(int fd, uint32_t events, FdEventHandler *handler)
+    {
+        if (!AddFd(fd, events, handler->GetHandlerFunc(), handler->GetErrorFunc()))
+        {
+            return false;
+        }
+        _entries[fd]->_handler = handler;
+        handler->_aggregator = this;
+        return true;
+    }
+
+    /**
+    * Change the polled events of a fd already added.
+    *
+    * @param fd The fd added before.
+    * @param events New epoll events to poll.
+    * @return True if the events are changed successfully, false otherwise.
+    */
+    bool ModifyFd(int fd, uint32_t events)
+    {
+        auto *entry = GetEntry(fd);
+        if (!entry)
+        {
+            return false;
+        }
+
+        struct epoll_event ep_event;
+        ep_event.data.ptr = entry;
+        ep_event.events = events;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ep_event) == -1)
+        {
+            LEOPARD_LOG_ERROR("Failed to modify fd in aggregator: fd={}, errno={}, err_text={}", fd, errno, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    /**
+    * Remove a fd from the aggregator. It's safe to call it from a callback, pending events of the fd are dropped.
+    *
+    * @param fd The fd added before.
+    * @return True if the fd is removed successfully, false otherwise.
+    */
+    bool RemoveFd(int fd)
+    {
+        auto *entry = GetEntry(fd);
+        if (!entry)
+        {
+            return false;
+        }
+
+        // The entry itself is kept, as it may still be referenced by the events being handled.
+        Deactivate(entry);
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1)
+        {
+            LEOPARD_LOG_ERROR("Failed to remove fd from aggregator: fd={}, errno={}, err_text={}", fd, errno, strerror(errno));
             return false;
         }
         return true;
     }
 
+    /**
+    * Get how long the reactor may block without missing an event of this aggregator, used by Reactor.
+    *
+    * @return Always UINT64_MAX, as the reactor blocks in this aggregator.
+    */
+    uint64_t GetIdleTimeout()
+    {
+        return UINT64_MAX;
+    }
+
 protected:
-    void CollectEvents()
+    std::size_t CollectEvents()
     {
         int number = epoll_wait(_epoll_fd, _events, MAX_EPOLL_EVENTS, 0);
         if (number == -1)
@@ -68,39 +234,164 @@ protected:
         {
             HandleEvents(_events, number);
         }
+        return number;
+    }
+
+    /**
+    * Block until any fd has an event or the timeout expires, then handle the events.
+    *
+    * @param timeout_ns Max time to block in nano-seconds, UINT64_MAX to block forever. It's rounded up to
+    *                   milli-seconds on kernels older than 5.11, which have no epoll_pwait2().
+    * @return Number of events handled.
+    */
+    std::size_t WaitEvents(uint64_t timeout_ns)
+    {
+        int number = -1;
+#ifdef __NR_epoll_pwait2
+        if (LIKELY(_has_epoll_pwait2))
+        {
+            struct timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(timeout_ns / 1000000000ULL);
+            timeout.tv_nsec = static_cast<long>(timeout_ns % 1000000000ULL);
+            number = static_cast<int>(syscall(__NR_epoll_pwait2, _epoll_fd, _events, MAX_EPOLL_EVENTS,
+                                              timeout_ns == UINT64_MAX ? nullptr : &timeout, nullptr, 0));
+            if ((number == -1) && (errno == ENOSYS))
+            {
+                _has_epoll_pwait2 = false;
+            }
+        }
+        if (UNLIKELY(!_has_epoll_pwait2))
+#endif
+        {
+            int timeout_ms = -1;
+            if (timeout_ns != UINT64_MAX)
+            {
+                auto ms = (timeout_ns + 999999) / 1000000;
+                timeout_ms = ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+            }
+            number = epoll_wait(_epoll_fd, _events, MAX_EPOLL_EVENTS, timeout_ms);
+        }
+        if (number == -1)
+        {
+            if (errno == EINTR)
+            {
+                return 0;
+            }
+            throw std::system_error(errno, std::system_category(), std::string("epoll_wait() error: ").append(strerror(errno)).c_str());
+        }
+        HandleEvents(_events, number);
+        return number;
     }
 
 private:
+    struct FdEntry
+    {
+        int _fd{-1};
+        bool _active{false};
+        // Set if added with a FdEventHandler, unlinked on removal.
+        FdEventHandler *_handler{nullptr};
+        Callback _on_read;
+        Callback _on_write;
+        Callback _on_error;
+    };
+
+    FdEntry* GetEntry(int fd)
+    {
+        if ((fd < 0) || (static_cast<std::size_t>(fd) >= _entries.size()) || !_entries[fd] || !_entries[fd]->_active)
+        {
+            return nullptr;
+        }
+        return _entries[fd].get();
+    }
+
+    void Deactivate(FdEntry *entry)
+    {
+        entry->_active = false;
+        if (entry->_handler)
+        {
+            entry->_handler->_aggregator = nullptr;
+            entry->_handler = nullptr;
+        }
+        if (entry == _dispatching)
+        {
+            // Removed from its own callback, which is still running: reset once it returns.
+            return;
+        }
+        entry->_on_read.Reset();
+        entry->_on_write.Reset();
+        entry->_on_error.Reset();
+    }
+
     void HandleEvents(struct epoll_event *events, int number)
     {
         for (int i = 0; i < number; ++i)
         {
-            auto *handler = static_cast<FdEventHandler*>(events[i].data.ptr);
+            auto *entry = static_cast<FdEntry*>(events[i].data.ptr);
+            if (UNLIKELY(!entry->_active))
+            {
+                // Removed by a callback run earlier in this batch.
+                continue;
+            }
 
-            if ((events[i].events & EPOLLERR) || (events[i].events & EPOLLRDHUP))
+            // EPOLLHUP is reported even if not polled, reading a hung-up fd would spin.
+            if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
             {
-                if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, handler->GetFd(), nullptr) == -1)
+                if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, entry->_fd, nullptr) == -1)
                 {
-                    std::cout << "Failed to remove fd from aggregator: fd=" << handler->GetFd() << ", errno=" << errno << ", err_text=" << strerror(errno) << std::endl;
+                    LEOPARD_LOG_ERROR("Failed to remove fd from aggregator: fd={}, errno={}, err_text={}", entry->_fd, errno, strerror(errno));
                 }
                 else
                 {
-                    std::cout << "Detected error when polling fd, removed it from aggregator: fd=" << handler->GetFd() << std::endl;
+                    LEOPARD_LOG_ERROR("Detected error when polling fd, removed it from aggregator: fd={}", entry->_fd);
+                }
+                auto on_error = std::move(entry->_on_error);
+                Deactivate(entry);
+                if (on_error)
+                {
+                    on_error();
                 }
-                handler->GetErrorFunc()();
                 // Don't close fd here, leaving it to upper level.
+                continue;
+            }
+
+            _dispatching = entry;
+            if ((events[i].events & EPOLLIN) && entry->_on_read)
+            {
+                entry->_on_read();
+            }
+            // The read callback may have removed the fd.
+            if ((events[i].events & EPOLLOUT) && entry->_active && entry->_on_write)
+            {
+                entry->_on_write();
             }
-            else if (events[i].events & EPOLLIN)
+            _dispatching = nullptr;
+            if (UNLIKELY(!entry->_active))
             {
-                handler->GetHandlerFunc()();
+                Deactivate(entry);
             }
         }
+        // Nothing from this batch refers to them anymore.
+        _retired.clear();
     }
 
     int _epoll_fd{0};
+    bool _has_epoll_pwait2{true};
     struct epoll_event _events[MAX_EPOLL_EVENTS];
+    // Indexed by fd, entries are never freed before the aggregator so that the pointers in epoll stay valid.
+    std::vector<std::unique_ptr<FdEntry>> _entries;
+    // Entry whose callback is running, and entries replaced while their callback was running.
+    FdEntry *_dispatching{nullptr};
+    std::vector<std::unique_ptr<FdEntry>> _retired;
 };
 
+inline void FdEventHandler::RemoveFromAggregator()
+{
+    if (_aggregator)
+    {
+        _aggregator->RemoveFd(_fd);
+    }
+}
+
 }} // namespace utils::leopard
 
 #endif // LEOPARD_UTILS_FDAGGREGATOR_HXX_
\ No newline at end of file
@@ -0,0 +1,307 @@
+#ifndef LEOPARD_UTILS_FIXEDSIZEPOOL_HXX_
+#define LEOPARD_UTILS_FIXEDSIZEPOOL_HXX_
+
+#include "Common.hxx"
+#include "Logger.hxx"
+#include "NonCopyable.hxx"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace leopard { namespace utils {
+
+//
+// - Lock-free pool of fixed-size blocks, e.g. payload buffers referenced by ring-buffer messages: allocated by
+//   producers, released by consumers, with no malloc in steady state.
+// - The memory is mapped once at Init(), on huge pages if the system has some reserved (otherwise transparent
+//   huge pages are requested), and pre-faulted so that no page fault hits the hot path.
+// - Each thread has a cache of free blocks, refilled from / flushed to a global lock-free freelist in batches,
+//   so most Allocate()/Deallocate() calls touch no shared cache line. A block can be released by any thread.
+// - Blocks held in the caches of other threads can't be allocated, size the pool with some slack
+//   (up to CACHE_SIZE blocks per thread).
+//
+class FixedSizePool : private NonCopyable
+{
+public:
+    static constexpr std::size_t MAX_THREADS{128};
+    static constexpr uint32_t CACHE_SIZE{64};
+    static constexpr std::size_t HUGE_PAGE_SIZE{2 * 1024 * 1024};
+
+    FixedSizePool() = default;
+
+    ~FixedSizePool()
+    {
+        if (_memory)
+        {
+            munmap(_memory, _memory_size);
+        }
+    }
+
+    /**
+    * Map and pre-fault the memory of the pool.
+    *
+    * @param block_size Size of each block, rounded up to the alignment of max_align_t.
+    * @param block_number Number of blocks.
+    * @return True if the pool is initialized successfully, false if it has already been initialized or mapping failed.
+    */
+    bool Init(std::size_t block_size, uint32_t block_number)
+    {
+        if (_memory)
+        {
+            LEOPARD_LOG_WARN("Pool already initialized: block_size={}, block_number={}", _block_size, _block_number);
+            return false;
+        }
+        if ((block_size == 0) || (block_number == 0) || (block_number == NIL))
+        {
+            LEOPARD_LOG_ERROR("Invalid pool size: block_size={}, block_number={}", block_size, block_number);
+            return false;
+        }
+
+        _block_size = (block_size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+        _block_number = block_number;
+        auto size = _block_size * _block_number;
+
+        _memory_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        auto *memory = mmap(nullptr, _memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        _huge_page = (memory != MAP_FAILED);
+        if (!_huge_page)
+        {
+            memory = mmap(nullptr, _memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+            {
+                LEOPARD_LOG_ERROR("Failed to map pool: size={}, errno={}, err_text={}", _memory_size, errno, strerror(errno));
+                return false;
+            }
+            static_cast<void>(madvise(memory, _memory_size, MADV_HUGEPAGE));
+        }
+
+        // Touch every page, so that the first use of a block doesn't fault (MAP_POPULATE is best effort).
+        auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        for (std::size_t offset = 0; offset < _memory_size; offset += page_size)
+        {
+            static_cast<volatile char*>(memory)[offset] = 0;
+        }
+
+        _next.reset(new std::atomic<uint32_t>[_block_number]);
+        for (uint32_t i = 0; i < _block_number; ++i)
+        {
+            _next[i].store(i + 1 < _block_number ? i + 1 : NIL, std::memory_order_relaxed);
+        }
+        _head.store(Pack(0, 0), std::memory_order_relaxed);
+        _memory = static_cast<char*>(memory);
+        return true;
+    }
+
+    /**
+    * Allocate a block.
+    *
+    * @return Pointer to a block of GetBlockSize() bytes, nullptr if the pool is exhausted.
+    */
+    void* Allocate()
+    {
+        auto *cache = GetCache();
+        if (UNLIKELY(!cache))
+        {
+            auto index = Pop();
+            return index == NIL ? nullptr : _memory + index * _block_size;
+        }
+
+        if (UNLIKELY(cache->_size == 0))
+        {
+            cache->_size = PopBatch(cache->_blocks, CACHE_SIZE / 2);
+            if (cache->_size == 0)
+            {
+                return nullptr;
+            }
+        }
+        return _memory + cache->_blocks[--cache->_size] * _block_size;
+    }
+
+    /**
+    * Return a block to the pool, from any thread.
+    *
+    * @param block Pointer returned by Allocate().
+    */
+    void Deallocate(void *block)
+    {
+        auto index = static_cast<uint32_t>((static_cast<char*>(block) - _memory) / _block_size);
+        auto *cache = GetCache();
+        if (UNLIKELY(!cache))
+        {
+            Push(index, index);
+            return;
+        }
+
+        if (UNLIKELY(cache->_size == CACHE_SIZE))
+        {
+            // Hand the older half over to the other threads in one go.
+            for (uint32_t i = 0; i + 1 < CACHE_SIZE / 2; ++i)
+            {
+                _next[cache->_blocks[i]].store(cache->_blocks[i + 1], std::memory_order_relaxed);
+            }
+            Push(cache->_blocks[0], cache->_blocks[CACHE_SIZE / 2 - 1]);
+            std::memmove(cache->_blocks, cache->_blocks + CACHE_SIZE / 2, sizeof(uint32_t) * (CACHE_SIZE / 2));
+            cache->_size = CACHE_SIZE / 2;
+        }
+        cache->_blocks[cache->_size++] = index;
+    }
+
+    template <typename T, typename... Args>
+    T* New(Args&&... args)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned type");
+        if (sizeof(T) > _block_size)
+        {
+            return nullptr;
+        }
+        auto *block = Allocate();
+        return block ? ::new (block) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    template <typename T>
+    void Delete(T *obj)
+    {
+        obj->~T();
+        Deallocate(obj);
+    }
+
+    std::size_t GetBlockSize() const
+    {
+        return _block_size;
+    }
+
+    uint32_t GetBlockNumber() const
+    {
+        return _block_number;
+    }
+
+    bool IsHugePage() const
+    {
+        return _huge_page;
+    }
+
+private:
+    static constexpr uint32_t NIL{UINT32_MAX};
+
+    struct alignas(CACHE_LINE_SIZE) Cache
+    {
+        uint32_t _size{0};
+        uint32_t _blocks[CACHE_SIZE];
+    };
+
+    //
+    // Process wide index of the calling thread, shared by all the pools so that each of them needs just an
+    // array of caches. Indexes are recycled on thread exit, the next owner inherits the cached blocks.
+    //
+    class ThreadSlot
+    {
+    public:
+        ThreadSlot()
+        {
+            for (std::size_t w = 0; w < MAX_THREADS / 64; ++w)
+            {
+                auto bits = _used[w].load(std::memory_order_relaxed);
+                while (~bits)
+                {
+                    auto bit = __builtin_ctzll(~bits);
+                    if (_used[w].compare_exchange_weak(bits, bits | (1ULL << bit), std::memory_order_acquire, std::memory_order_relaxed))
+                    {
+                        _index = w * 64 + bit;
+                        return;
+                    }
+                }
+            }
+        }
+
+        ~ThreadSlot()
+        {
+            if (_index != MAX_THREADS)
+            {
+                _used[_index / 64].fetch_and(~(1ULL << (_index % 64)), std::memory_order_release);
+            }
+        }
+
+        std::size_t GetIndex() const
+        {
+            return _index;
+        }
+
+    private:
+        static inline std::atomic<uint64_t> _used[MAX_THREADS / 64]{};
+        std::size_t _index{MAX_THREADS};
+    };
+
+    // Null if the thread is beyond MAX_THREADS, it then goes to the global freelist directly.
+    Cache* GetCache()
+    {
+        static thread_local ThreadSlot slot;
+        auto index = slot.GetIndex();
+        return index < MAX_THREADS ? &_caches[index] : nullptr;
+    }
+
+    // The head of the freelist is tagged with a counter bumped on each update, against ABA.
+    static uint64_t Pack(uint32_t tag, uint32_t index)
+    {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+
+    // Push the chain first -> ... -> last, already linked through _next.
+    void Push(uint32_t first, uint32_t last)
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+        do
+        {
+            _next[last].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        }
+        while (!_head.compare_exchange_weak(head, Pack(static_cast<uint32_t>(head >> 32) + 1, first), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    uint32_t Pop()
+    {
+        uint32_t index = NIL;
+        PopBatch(&index, 1);
+        return index;
+    }
+
+    // Pop up to max blocks with a single successful CAS, returns the number popped.
+    uint32_t PopBatch(uint32_t *blocks, uint32_t max)
+    {
+        auto head = _head.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(head) != NIL)
+        {
+            // The links walked may be stale if another thread pops meanwhile, the tag makes the CAS fail then.
+            uint32_t number = 0;
+            auto next = static_cast<uint32_t>(head);
+            do
+            {
+                blocks[number++] = next;
+                next = _next[next].load(std::memory_order_relaxed);
+            }
+            while ((number < max) && (next != NIL));
+
+            if (_head.compare_exchange_weak(head, Pack(static_cast<uint32_t>(head >> 32) + 1, next), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                return number;
+            }
+        }
+        return 0;
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _head{Pack(0, NIL)};
+    alignas(CACHE_LINE_SIZE) char *_memory{nullptr};
+    std::size_t _memory_size{0};
+    std::size_t _block_size{0};
+    uint32_t _block_number{0};
+    bool _huge_page{false};
+    std::unique_ptr<std::atomic<uint32_t>[]> _next;
+    Cache _caches[MAX_THREADS];
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_FIXEDSIZEPOOL_HXX_
@@ -0,0 +1,156 @@
+#ifndef LEOPARD_UTILS_HISTOGRAM_HXX_
+#define LEOPARD_UTILS_HISTOGRAM_HXX_
+
+#include "Common.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace leopard { namespace utils {
+
+//
+// - HDR-style latency histogram: log-linear buckets covering the whole uint64_t range with a fixed relative
+//   precision (1 / SUB_BUCKETS, i.e. < 1%), so that tails (p99.9, max) are as precise as the median.
+// - Record() is a few instructions and never allocates, the buckets are allocated once by the constructor.
+// - NOT thread safe, use one histogram per thread and Merge() them.
+//
+class Histogram
+{
+public:
+    static constexpr uint32_t SUB_BUCKET_BITS{7};
+    static constexpr uint32_t SUB_BUCKETS{1 << SUB_BUCKET_BITS};
+    static constexpr uint32_t BUCKET_NUMBER{(64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS};
+
+    Histogram() : _counts(new uint64_t[BUCKET_NUMBER]())
+    {
+    }
+
+    Histogram(const Histogram &other) : Histogram()
+    {
+        Merge(other);
+    }
+
+    Histogram& operator = (const Histogram &other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            Merge(other);
+        }
+        return *this;
+    }
+
+    ALWAYS_INLINE void Record(uint64_t value)
+    {
+        ++_counts[GetIndex(value)];
+        ++_count;
+        _sum += value;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+    }
+
+    void Merge(const Histogram &other)
+    {
+        for (uint32_t i = 0; i < BUCKET_NUMBER; ++i)
+        {
+            _counts[i] += other._counts[i];
+        }
+        _count += other._count;
+        _sum += other._sum;
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+    }
+
+    void Reset()
+    {
+        std::fill(_counts.get(), _counts.get() + BUCKET_NUMBER, 0);
+        _count = 0;
+        _sum = 0;
+        _min = std::numeric_limits<uint64_t>::max();
+        _max = 0;
+    }
+
+    /**
+    * Get the value at a percentile.
+    *
+    * @param percentile Percentile in [0, 100], e.g. 99.9.
+    * @return Highest value of the bucket reaching the percentile (capped to the max recorded), 0 if empty.
+    */
+    uint64_t GetPercentile(double percentile) const
+    {
+        if (_count == 0)
+        {
+            return 0;
+        }
+        percentile = std::min(std::max(percentile, 0.0), 100.0);
+        auto target = static_cast<uint64_t>(percentile / 100.0 * _count + 0.5);
+        target = std::max<uint64_t>(target, 1);
+
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKET_NUMBER; ++i)
+        {
+            seen += _counts[i];
+            if (seen >= target)
+            {
+                return std::min(GetHighestValue(i), _max);
+            }
+        }
+        return _max;
+    }
+
+    uint64_t GetCount() const
+    {
+        return _count;
+    }
+
+    uint64_t GetMin() const
+    {
+        return _count ? _min : 0;
+    }
+
+    uint64_t GetMax() const
+    {
+        return _max;
+    }
+
+    double GetMean() const
+    {
+        return _count ? static_cast<double>(_sum) / _count : 0.0;
+    }
+
+private:
+    static ALWAYS_INLINE uint32_t GetIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return static_cast<uint32_t>(value);
+        }
+        // The SUB_BUCKET_BITS + 1 top bits select the bucket, within the power of 2 range of the value.
+        uint32_t msb = 63 - __builtin_clzll(value);
+        uint32_t shift = msb - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<uint32_t>((value >> shift) - SUB_BUCKETS);
+    }
+
+    static uint64_t GetHighestValue(uint32_t index)
+    {
+        if (index < 2 * SUB_BUCKETS)
+        {
+            return index;
+        }
+        uint32_t shift = index / SUB_BUCKETS - 1;
+        uint64_t top = SUB_BUCKETS + index % SUB_BUCKETS;
+        return ((top + 1) << shift) - 1;
+    }
+
+    std::unique_ptr<uint64_t[]> _counts;
+    uint64_t _count{0};
+    uint64_t _sum{0};
+    uint64_t _min{std::numeric_limits<uint64_t>::max()};
+    uint64_t _max{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_HISTOGRAM_HXX_
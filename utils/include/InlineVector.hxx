@@ -0,0 +1,173 @@
+#ifndef LEOPARD_UTILS_INLINEVECTOR_HXX_
+#define LEOPARD_UTILS_INLINEVECTOR_HXX_
+
+#include "Common.hxx"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace leopard { namespace utils {
+
+//
+// - Vector with a fixed capacity stored inline, it never allocates. Meant for ring-buffer messages, so that
+//   filling a message on the producer hot path doesn't call malloc.
+// - push_back()/emplace_back()/resize() fail (return false) instead of growing past the capacity.
+//
+template <typename T, std::size_t Capacity>
+class InlineVector
+{
+public:
+    static_assert(Capacity > 0, "Capacity must be positive");
+
+    InlineVector() = default;
+
+    InlineVector(const InlineVector &other)
+    {
+        for (auto &v : other)
+        {
+            new (&_data[_size++]) T(v);
+        }
+    }
+
+    InlineVector& operator = (const InlineVector &other)
+    {
+        if (this != &other)
+        {
+            clear();
+            for (auto &v : other)
+            {
+                new (&_data[_size++]) T(v);
+            }
+        }
+        return *this;
+    }
+
+    ~InlineVector()
+    {
+        clear();
+    }
+
+    template <typename... Args>
+    bool emplace_back(Args&&... args)
+    {
+        if (UNLIKELY(_size == Capacity))
+        {
+            return false;
+        }
+        new (&_data[_size]) T(std::forward<Args>(args)...);
+        ++_size;
+        return true;
+    }
+
+    bool push_back(const T &v)
+    {
+        return emplace_back(v);
+    }
+
+    bool push_back(T &&v)
+    {
+        return emplace_back(std::move(v));
+    }
+
+    void pop_back()
+    {
+        --_size;
+        (*this)[_size].~T();
+    }
+
+    void clear()
+    {
+        while (_size)
+        {
+            pop_back();
+        }
+    }
+
+    /**
+    * Shrink, or grow with default constructed elements.
+    *
+    * @param size New size.
+    * @return True if resized, false if size is over the capacity.
+    */
+    bool resize(std::size_t size)
+    {
+        if (size > Capacity)
+        {
+            return false;
+        }
+        while (_size > size)
+        {
+            pop_back();
+        }
+        while (_size < size)
+        {
+            emplace_back();
+        }
+        return true;
+    }
+
+    T& operator[](std::size_t i)
+    {
+        return *std::launder(reinterpret_cast<T*>(&_data[i]));
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        return *std::launder(reinterpret_cast<const T*>(&_data[i]));
+    }
+
+    T* data()
+    {
+        return std::launder(reinterpret_cast<T*>(_data));
+    }
+
+    const T* data() const
+    {
+        return std::launder(reinterpret_cast<const T*>(_data));
+    }
+
+    T* begin()
+    {
+        return data();
+    }
+
+    T* end()
+    {
+        return data() + _size;
+    }
+
+    const T* begin() const
+    {
+        return data();
+    }
+
+    const T* end() const
+    {
+        return data() + _size;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    static constexpr std::size_t capacity()
+    {
+        return Capacity;
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _data[Capacity];
+    std::size_t _size{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_INLINEVECTOR_HXX_
@@ -0,0 +1,596 @@
+#ifndef LEOPARD_UTILS_IOURINGAGGREGATOR_HXX_
+#define LEOPARD_UTILS_IOURINGAGGREGATOR_HXX_
+
+#include "Delegate.hxx"
+#include "FdAggregator.hxx"
+#include "Logger.hxx"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+//
+// - Aggregator receiving from sockets through io_uring, a drop-in alternative to FdAggregator for Reactor.
+// - Each socket has one multishot recv request, the kernel picks a buffer from a provided buffer ring and
+//   posts a completion per message. Reaping completions reads shared memory only, so in steady state
+//   there is no syscall per message. New requests are batched into one io_uring_enter() per pass.
+// - Handlers get a view of the kernel-filled buffer and must hand it back through ReleaseBuffer().
+// - NOT thread safe, call everything from the reactor thread (or before the reactor runs).
+// - Talks to the kernel ABI directly (<linux/io_uring.h>), so there is no dependency on liburing.
+//
+class IoUringAggregator
+{
+public:
+    IoUringAggregator(const IoUringAggregator&) = delete;
+    IoUringAggregator& operator = (const IoUringAggregator&) = delete;
+
+    static constexpr uint32_t QUEUE_DEPTH{256};
+    static constexpr uint32_t BUFFER_NUMBER{1024}; // Must be a power of 2.
+    static constexpr uint32_t BUFFER_SIZE{2048};
+    static constexpr uint16_t BUFFER_GROUP_ID{0};
+
+    struct Buffer
+    {
+        const char *_data{nullptr};
+        std::size_t _size{0};
+        uint16_t _id{0};
+    };
+
+    using RecvCallback = Delegate<void(const Buffer&)>;
+    using ErrorCallback = Delegate<void()>;
+
+    IoUringAggregator()
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        _ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params));
+        if (_ring_fd < 0)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to initialize IoUringAggregator: ").append(strerror(errno)).c_str());
+        }
+
+        try
+        {
+            MapRings(params);
+            RegisterBufferRing();
+        }
+        catch (...)
+        {
+            Release();
+            throw;
+        }
+    }
+
+    ~IoUringAggregator()
+    {
+        Release();
+    }
+
+    /**
+    * Start receiving from a socket.
+    *
+    * @param fd The socket to receive from.
+    * @param on_recv Called with each received message (datagram or stream chunk).
+    * @param on_error Called when an error or the peer's hang-up is detected, the socket has been removed by then.
+    * @return True if the socket is added successfully, false otherwise.
+    */
+    bool AddSocket(int fd, RecvCallback on_recv, ErrorCallback on_error)
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (static_cast<std::size_t>(fd) >= _entries.size())
+        {
+            _entries.resize(fd + 1);
+        }
+        if (_entries[fd] && _entries[fd]->_active)
+        {
+            LEOPARD_LOG_WARN("Failed to add socket to aggregator as it is already added: fd={}", fd);
+            return false;
+        }
+        if (_entries[fd] && (_entries[fd].get() == _dispatching))
+        {
+            // Re-added from its own callback: the running callback stays in the old entry until it returns.
+            _retired.push_back(std::move(_entries[fd]));
+        }
+        if (!_entries[fd])
+        {
+            _entries[fd].reset(new SocketEntry());
+        }
+
+        auto *entry = _entries[fd].get();
+
+        int type = 0;
+        socklen_t len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1)
+        {
+            LEOPARD_LOG_ERROR("Failed to add socket to aggregator: fd={}, errno={}, err_text={}", fd, errno, strerror(errno));
+            return false;
+        }
+
+        entry->_fd = fd;
+        entry->_active = true;
+        entry->_stream = (type == SOCK_STREAM);
+        entry->_starved = false;
+        entry->_on_recv = std::move(on_recv);
+        entry->_on_error = std::move(on_error);
+        PrepareRecv(entry);
+        return true;
+    }
+
+    /**
+    * Stop receiving from a socket. It's safe to call it from a callback, pending messages of the socket are dropped.
+    *
+    * @param fd The socket added before.
+    * @return True if the socket is removed successfully, false otherwise.
+    */
+    bool RemoveSocket(int fd)
+    {
+        if ((fd < 0) || (static_cast<std::size_t>(fd) >= _entries.size()) || !_entries[fd] || !_entries[fd]->_active)
+        {
+            return false;
+        }
+
+        auto *entry = _entries[fd].get();
+        Deactivate(entry);
+        auto *sqe = GetSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(entry);
+        sqe->user_data = 0; // Completion of the cancel request itself is ignored.
+        return true;
+    }
+
+    /**
+    * Give a buffer received in a callback back to the kernel.
+    *
+    * @param buffer The buffer passed to the receive callback.
+    */
+    void ReleaseBuffer(const Buffer &buffer)
+    {
+        RecycleBuffer(buffer._id);
+    }
+
+    /**
+    * Get the number of io_uring_enter() syscalls made so far.
+    *
+    * @return Number of io_uring_enter() syscalls.
+    */
+    uint64_t GetSyscallNumber()
+    {
+        return _syscall_count;
+    }
+
+    /**
+    * Register the ring fd to a FdAggregator, so that a reactor blocking in it wakes up on completions.
+    *
+    * @param aggregator The FdAggregator to register the ring to, typically the one of the same reactor. It must
+    *                   outlive this aggregator, e.g. list it first in the Reactor.
+    * @return True if the ring is registered successfully, false otherwise.
+    */
+    bool EnableBlocking(FdAggregator &aggregator)
+    {
+        _blocking = aggregator.AddFd(_ring_fd, EPOLLIN, [](){}, [](){});
+        _blocking_aggregator = _blocking ? &aggregator : nullptr;
+        return _blocking;
+    }
+
+    /**
+    * Get how long the reactor may block without missing a completion, used by Reactor.
+    *
+    * @return UINT64_MAX if the ring can wake up the reactor and nothing is pending, 0 otherwise.
+    */
+    uint64_t GetIdleTimeout()
+    {
+        if (!_blocking || (_sq_local_tail != *_sq_tail) || (*_cq_head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+            || (__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+        {
+            return 0;
+        }
+        for (auto *entry : _starved)
+        {
+            if (entry->_active && entry->_starved && (entry->_armed_recycle_count != _recycle_count))
+            {
+                // Buffers were released, the request must be re-armed.
+                return 0;
+            }
+        }
+        return UINT64_MAX;
+    }
+
+protected:
+    std::size_t CollectEvents()
+    {
+        if (UNLIKELY(!_starved.empty()))
+        {
+            Rearm();
+        }
+        Submit();
+        if (UNLIKELY(!_retired.empty()))
+        {
+            // After Submit(), so that the cancel requests referring to them have reached the kernel.
+            ReclaimRetired();
+        }
+
+        auto number = ReapCompletions();
+        if (UNLIKELY(__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+        {
+            // The kernel keeps the completions that didn't fit into the CQ (IORING_FEAT_NODROP), including the
+            // ones terminating multishot requests. They are only moved to the CQ by io_uring_enter(GETEVENTS).
+            Enter(0, IORING_ENTER_GETEVENTS);
+            number += ReapCompletions();
+        }
+        return number;
+    }
+
+private:
+    struct SocketEntry
+    {
+        int _fd{-1};
+        bool _active{false};
+        bool _stream{false};
+        // Multishot request terminated for lack of buffers, re-armed once some are recycled.
+        bool _starved{false};
+        // A request is armed in the kernel, its completions still refer to the entry.
+        bool _armed{false};
+        uint64_t _armed_recycle_count{0};
+        RecvCallback _on_recv;
+        ErrorCallback _on_error;
+    };
+
+    void MapRings(const struct io_uring_params &params)
+    {
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+        {
+            throw std::system_error(ENOTSUP, std::system_category(), "Failed to initialize IoUringAggregator: kernel is too old");
+        }
+
+        _ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                              params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        _ring = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+        if (_ring == MAP_FAILED)
+        {
+            _ring = nullptr;
+            throw std::system_error(errno, std::system_category(), std::string("Failed to map io_uring: ").append(strerror(errno)).c_str());
+        }
+
+        _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to map io_uring SQEs: ").append(strerror(errno)).c_str());
+        }
+        _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        auto *base = static_cast<char*>(_ring);
+        _sq_head = reinterpret_cast<uint32_t*>(base + params.sq_off.head);
+        _sq_flags = reinterpret_cast<uint32_t*>(base + params.sq_off.flags);
+        _sq_tail = reinterpret_cast<uint32_t*>(base + params.sq_off.tail);
+        _sq_mask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+        _sq_entries = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_entries);
+        _sq_array = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+        _cq_head = reinterpret_cast<uint32_t*>(base + params.cq_off.head);
+        _cq_tail = reinterpret_cast<uint32_t*>(base + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+    }
+
+    void RegisterBufferRing()
+    {
+        static_assert(BUFFER_NUMBER && !(BUFFER_NUMBER & (BUFFER_NUMBER - 1)), "BUFFER_NUMBER must be a power of 2.");
+
+        _buf_ring_size = BUFFER_NUMBER * sizeof(struct io_uring_buf);
+        void *buf_ring = mmap(nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (buf_ring == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to allocate io_uring buffer ring: ").append(strerror(errno)).c_str());
+        }
+        _buf_ring = static_cast<struct io_uring_buf_ring*>(buf_ring);
+
+        _buffers_size = static_cast<std::size_t>(BUFFER_NUMBER) * BUFFER_SIZE;
+        void *buffers = mmap(nullptr, _buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (buffers == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to allocate io_uring buffers: ").append(strerror(errno)).c_str());
+        }
+        _buffers = static_cast<char*>(buffers);
+
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(_buf_ring);
+        reg.ring_entries = BUFFER_NUMBER;
+        reg.bgid = BUFFER_GROUP_ID;
+        if (syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to register io_uring buffer ring: ").append(strerror(errno)).c_str());
+        }
+
+        for (uint32_t i = 0; i < BUFFER_NUMBER; ++i)
+        {
+            RecycleBuffer(static_cast<uint16_t>(i));
+        }
+    }
+
+    void Release()
+    {
+        if (_buffers)
+        {
+            munmap(_buffers, _buffers_size);
+        }
+        if (_buf_ring)
+        {
+            munmap(_buf_ring, _buf_ring_size);
+        }
+        if (_sqes)
+        {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_ring)
+        {
+            munmap(_ring, _ring_size);
+        }
+        if (_blocking_aggregator)
+        {
+            _blocking_aggregator->RemoveFd(_ring_fd);
+        }
+        close(_ring_fd);
+    }
+
+    ALWAYS_INLINE void RecycleBuffer(uint16_t id)
+    {
+        // Don't use _buf_ring->bufs, the flexible array wrapper in the kernel header shifts it in C++.
+        auto &buf = reinterpret_cast<struct io_uring_buf*>(_buf_ring)[_buf_ring_tail & (BUFFER_NUMBER - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(_buffers + static_cast<std::size_t>(id) * BUFFER_SIZE);
+        buf.len = BUFFER_SIZE;
+        buf.bid = id;
+        __atomic_store_n(&_buf_ring->tail, ++_buf_ring_tail, __ATOMIC_RELEASE);
+        ++_recycle_count;
+    }
+
+    struct io_uring_sqe* GetSqe()
+    {
+        if (_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+        {
+            // Submission queue is full, flush it first.
+            Submit();
+        }
+
+        auto idx = _sq_local_tail & _sq_mask;
+        auto *sqe = &_sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        _sq_array[idx] = idx;
+        ++_sq_local_tail;
+        return sqe;
+    }
+
+    void Submit()
+    {
+        auto to_submit = _sq_local_tail - *_sq_tail;
+        if (LIKELY(to_submit == 0))
+        {
+            return;
+        }
+
+        __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+        Enter(to_submit, 0);
+    }
+
+    void Enter(uint32_t to_submit, uint32_t flags)
+    {
+        ++_syscall_count;
+        if ((syscall(__NR_io_uring_enter, _ring_fd, to_submit, 0, flags, nullptr, 0) < 0) && (errno != EINTR))
+        {
+            throw std::system_error(errno, std::system_category(), std::string("io_uring_enter() error: ").append(strerror(errno)).c_str());
+        }
+    }
+
+    std::size_t ReapCompletions()
+    {
+        auto head = *_cq_head;
+        auto tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        std::size_t number = tail - head;
+        for (; head != tail; ++head)
+        {
+            // Copy out, since the slot can be reused once the head is moved.
+            auto cqe = _cqes[head & _cq_mask];
+            HandleCompletion(cqe);
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+        return number;
+    }
+
+    // Re-arms the starved requests once buffers have been recycled since they were armed.
+    void Rearm()
+    {
+        std::size_t kept = 0;
+        for (auto *entry : _starved)
+        {
+            if (!entry->_active || !entry->_starved)
+            {
+                continue;
+            }
+            if (entry->_armed_recycle_count != _recycle_count)
+            {
+                entry->_starved = false;
+                PrepareRecv(entry);
+            }
+            else
+            {
+                _starved[kept++] = entry;
+            }
+        }
+        _starved.resize(kept);
+    }
+
+    void PrepareRecv(SocketEntry *entry)
+    {
+        auto *sqe = GetSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = entry->_fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP_ID;
+        sqe->user_data = reinterpret_cast<uint64_t>(entry);
+        entry->_armed = true;
+        entry->_armed_recycle_count = _recycle_count;
+    }
+
+    // Free the replaced entries no completion can refer to anymore.
+    void ReclaimRetired()
+    {
+        _retired.erase(std::remove_if(_retired.begin(), _retired.end(), [](const std::unique_ptr<SocketEntry> &entry) {
+            return !entry->_armed;
+        }), _retired.end());
+    }
+
+    void Deactivate(SocketEntry *entry)
+    {
+        entry->_active = false;
+        entry->_starved = false;
+        if (entry == _dispatching)
+        {
+            // Removed from its own callback, which is still running: reset once it returns.
+            return;
+        }
+        entry->_on_recv.Reset();
+        entry->_on_error.Reset();
+    }
+
+    void HandleCompletion(const struct io_uring_cqe &cqe)
+    {
+        auto *entry = reinterpret_cast<SocketEntry*>(cqe.user_data);
+        if (!entry)
+        {
+            return;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            // The last completion of the request, re-armed below if need be.
+            entry->_armed = false;
+        }
+
+        bool has_buffer = (cqe.flags & IORING_CQE_F_BUFFER);
+        Buffer buffer;
+        buffer._id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if (UNLIKELY(!entry->_active))
+        {
+            // Removed while the message was in flight, drop it.
+            if (has_buffer)
+            {
+                RecycleBuffer(buffer._id);
+            }
+            return;
+        }
+
+        if (LIKELY(cqe.res > 0 || (cqe.res == 0 && !entry->_stream)))
+        {
+            buffer._data = _buffers + static_cast<std::size_t>(buffer._id) * BUFFER_SIZE;
+            buffer._size = static_cast<std::size_t>(cqe.res);
+            _dispatching = entry;
+            entry->_on_recv(buffer);
+            _dispatching = nullptr;
+            if (UNLIKELY(!entry->_active))
+            {
+                Deactivate(entry);
+                return;
+            }
+        }
+        else if (cqe.res != -ENOBUFS)
+        {
+            if (has_buffer)
+            {
+                RecycleBuffer(buffer._id);
+            }
+            if (cqe.res == 0)
+            {
+                LEOPARD_LOG_WARN("Detected hang-up when receiving from socket, removed it from aggregator: fd={}", entry->_fd);
+            }
+            else
+            {
+                LEOPARD_LOG_ERROR("Detected error when receiving from socket, removed it from aggregator: fd={}, errno={}, err_text={}", entry->_fd, -cqe.res, strerror(-cqe.res));
+            }
+            auto on_error = std::move(entry->_on_error);
+            Deactivate(entry);
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+            {
+                on_error();
+                return;
+            }
+            // Still armed in the kernel, cancel it before telling the upper level.
+            auto *sqe = GetSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(entry);
+            on_error();
+            return;
+        }
+
+        if ((cqe.flags & IORING_CQE_F_MORE) || !entry->_active)
+        {
+            return;
+        }
+        if ((cqe.res == -ENOBUFS) && (entry->_armed_recycle_count == _recycle_count))
+        {
+            // No buffer came back since the request was armed, re-arming now would fail again straight away.
+            entry->_starved = true;
+            _starved.push_back(entry);
+            return;
+        }
+        // The multishot request is terminated by the kernel for another reason (e.g. CQ overflow), re-arm it.
+        PrepareRecv(entry);
+    }
+
+    int _ring_fd{-1};
+    void *_ring{nullptr};
+    std::size_t _ring_size{0};
+    struct io_uring_sqe *_sqes{nullptr};
+    std::size_t _sqes_size{0};
+
+    uint32_t *_sq_head{nullptr};
+    uint32_t *_sq_flags{nullptr};
+    uint32_t *_sq_tail{nullptr};
+    uint32_t *_sq_array{nullptr};
+    uint32_t _sq_mask{0};
+    uint32_t _sq_entries{0};
+    uint32_t _sq_local_tail{0};
+
+    uint32_t *_cq_head{nullptr};
+    uint32_t *_cq_tail{nullptr};
+    uint32_t _cq_mask{0};
+    struct io_uring_cqe *_cqes{nullptr};
+
+    struct io_uring_buf_ring *_buf_ring{nullptr};
+    std::size_t _buf_ring_size{0};
+    uint16_t _buf_ring_tail{0};
+    uint64_t _recycle_count{0};
+    char *_buffers{nullptr};
+    std::size_t _buffers_size{0};
+
+    uint64_t _syscall_count{0};
+    bool _blocking{false};
+    FdAggregator *_blocking_aggregator{nullptr};
+    // Indexed by fd, entries are never freed before the aggregator so that the user_data in flight stays valid.
+    std::vector<std::unique_ptr<SocketEntry>> _entries;
+    // Entry whose callback is running, and entries replaced while their callback was running (kept until their
+    // request is over, for the same reason).
+    SocketEntry *_dispatching{nullptr};
+    std::vector<std::unique_ptr<SocketEntry>> _retired;
+    std::vector<SocketEntry*> _starved;
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_IOURINGAGGREGATOR_HXX_
\ No newline at end of file
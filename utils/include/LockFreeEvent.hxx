@@ -0,0 +1,206 @@
+#ifndef LEOPARD_UTILS_LOCKFREEEVENT_HXX_
+#define LEOPARD_UTILS_LOCKFREEEVENT_HXX_
+
+#include "Common.hxx"
+#include "Delegate.hxx"
+#include "NonCopyable.hxx"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+template <typename Signature, std::size_t Size = 4 * sizeof(void*)>
+class LockFreeEvent;
+
+//
+// - Event variant for the hot path: Notify() is wait-free and never allocates or locks, so any number of
+//   threads can notify concurrently.
+// - Observers are kept in an immutable flat vector of Delegate. Connect()/Disconnect() publish a new copy of
+//   it under a mutex, then reclaim the old one once no Notify() can still read it (RCU style grace period over
+//   two reader counters). They are slow, the grace period is waited for without holding the mutex so that a
+//   callback running meanwhile on another thread can still connect/disconnect.
+// - Connect()/Disconnect() can be called from inside a callback. The vector replaced then is reclaimed by
+//   the next Connect()/Disconnect() called outside of any callback of the event, or by the destructor.
+// - A callback disconnected concurrently with (or during) a Notify() may still be called by that Notify().
+//
+template <typename... Args, std::size_t Size>
+class LockFreeEvent<void(Args...), Size> : private NonCopyable
+{
+public:
+    using Callback = Delegate<void(Args...), Size>;
+
+    LockFreeEvent() = default;
+
+    ~LockFreeEvent()
+    {
+        delete _observers.load(std::memory_order_relaxed);
+        for (auto *observers : _retired)
+        {
+            delete observers;
+        }
+    }
+
+    /**
+    * Add an observer.
+    *
+    * @param callback Called on each Notify().
+    * @return Key of the observer to disconnect it.
+    */
+    uint32_t Connect(Callback callback)
+    {
+        uint32_t key;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            key = _observer_id++;
+            auto *observers = new Observers(*_observers.load(std::memory_order_relaxed));
+            observers->push_back(Observer{key, std::move(callback)});
+            Publish(observers);
+        }
+        Reclaim();
+        return key;
+    }
+
+    /**
+    * Remove an observer.
+    *
+    * @param key Key returned by Connect().
+    * @return True if the observer was connected, false otherwise.
+    */
+    bool Disconnect(uint32_t key)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            auto *current = _observers.load(std::memory_order_relaxed);
+            auto *observers = new Observers();
+            observers->reserve(current->size());
+            for (auto &observer : *current)
+            {
+                if (observer._key != key)
+                {
+                    observers->push_back(observer);
+                }
+            }
+            if (observers->size() == current->size())
+            {
+                delete observers;
+                return false;
+            }
+            Publish(observers);
+        }
+        Reclaim();
+        return true;
+    }
+
+    void Notify(Args... args)
+    {
+        // Stays on the stack of this thread, tells Connect()/Disconnect() that they run inside a callback.
+        NotifyFrame frame{this, _notifying};
+        _notifying = &frame;
+
+        auto &readers = _readers[_epoch.load(std::memory_order_seq_cst) & 1]._count;
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        for (auto &observer : *_observers.load(std::memory_order_seq_cst))
+        {
+            observer._callback(args...);
+        }
+        readers.fetch_sub(1, std::memory_order_release);
+
+        _notifying = frame._prev;
+    }
+
+    /**
+    * Get the number of observers.
+    *
+    * @return Number of observers.
+    */
+    std::size_t GetObserverNumber()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _observers.load(std::memory_order_relaxed)->size();
+    }
+
+private:
+    struct Observer
+    {
+        uint32_t _key;
+        Callback _callback;
+    };
+
+    using Observers = std::vector<Observer>;
+
+    struct NotifyFrame
+    {
+        const LockFreeEvent *_event;
+        NotifyFrame *_prev;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) ReaderCount
+    {
+        std::atomic<uint64_t> _count{0};
+    };
+
+    // Called with the mutex held.
+    void Publish(Observers *observers)
+    {
+        _retired.push_back(_observers.exchange(observers, std::memory_order_seq_cst));
+    }
+
+    // Called without the mutex held, a Notify() waited for may be in a callback blocked on it.
+    void Reclaim()
+    {
+        for (auto *frame = _notifying; frame; frame = frame->_prev)
+        {
+            if (frame->_event == this)
+            {
+                // Waiting for the readers would wait for ourselves.
+                return;
+            }
+        }
+
+        // One grace period at a time: two interleaved ones could flip the epoch so that neither waits
+        // for one of the counters.
+        std::lock_guard<std::mutex> reclaimGuard(_reclaim_mutex);
+        std::vector<Observers*> retired;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            retired.swap(_retired);
+        }
+        if (retired.empty())
+        {
+            return;
+        }
+
+        // Any Notify() still reading a retired vector has registered in one of the counters before it was
+        // replaced. Flip the epoch before each wait so that new Notify() calls can't keep the counter busy.
+        for (int i = 0; i < 2; ++i)
+        {
+            auto epoch = _epoch.fetch_add(1, std::memory_order_seq_cst);
+            while (_readers[epoch & 1]._count.load(std::memory_order_seq_cst) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        for (auto *observers : retired)
+        {
+            delete observers;
+        }
+    }
+
+    static inline thread_local NotifyFrame *_notifying{nullptr};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<Observers*> _observers{new Observers()};
+    std::atomic<uint64_t> _epoch{0};
+    ReaderCount _readers[2];
+
+    std::mutex _mutex;
+    std::mutex _reclaim_mutex;
+    uint32_t _observer_id{0};
+    std::vector<Observers*> _retired;
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_LOCKFREEEVENT_HXX_
@@ -0,0 +1,650 @@
+#ifndef LEOPARD_UTILS_LOGGER_HXX_
+#define LEOPARD_UTILS_LOGGER_HXX_
+
+#include "Common.hxx"
+#include "NonCopyable.hxx"
+#include "ThreadFactory.hxx"
+#include "Tsc.hxx"
+
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+enum class LogLevel : uint8_t
+{
+    debug, info, warn, error
+};
+
+//
+// Static description of a log statement, one per LEOPARD_LOG_XXX() call site. Its address is the id copied
+// into the ring in place of the format string.
+//
+struct LogSite
+{
+    LogLevel _level;
+    const char *_file;
+    int _line;
+    const char *_format;
+    // Decodes the raw arguments and formats the message, instantiated for the argument types of the site.
+    void (*_format_args)(const char *format, const char *args, std::string &out);
+};
+
+//
+// - Asynchronous binary logger. The logging thread only copies the LogSite id, a TSC timestamp and the raw
+//   arguments into a ring of its own, a background thread does the formatting and the file I/O.
+// - Use the LEOPARD_LOG_XXX() macros, the number of {} in the format string is checked against the number
+//   of arguments at compile time. Arguments can be arithmetic, enums, pointers and strings (copied, truncated
+//   to MAX_STRING_SIZE).
+// - When a ring is full, records are either dropped (and counted) or the logging thread blocks, see FullPolicy.
+// - Until Start() is called (and after Stop()), records are formatted synchronously to stdout, as if there was
+//   no background thread.
+//
+class Logger : private NonCopyable
+{
+public:
+    enum class FullPolicy
+    {
+        drop, block
+    };
+
+    static constexpr std::size_t DEFAULT_RING_CAPACITY{1 << 20};
+    static constexpr std::size_t MAX_STRING_SIZE{1024};
+    static constexpr uint32_t IDLE_SLEEP_US{100};
+
+    static Logger& GetInstance()
+    {
+        static Logger instance;
+        return instance;
+    }
+
+    ~Logger()
+    {
+        Stop();
+    }
+
+    /**
+    * Start the background thread.
+    *
+    * @param path File to append the logs to, empty for stdout.
+    * @param attributes Attributes of the background thread, e.g. to pin it to a non-critical core.
+    * @param policy What a logging thread does when its ring is full.
+    * @param ring_capacity Size in bytes of the ring of each logging thread, rounded up to a power of 2.
+    * @return True if started, false if already started or the file can't be opened.
+    */
+    bool Start(const std::string &path, const ThreadAttributes &attributes = ThreadAttributes(),
+               FullPolicy policy = FullPolicy::drop, std::size_t ring_capacity = DEFAULT_RING_CAPACITY)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_started.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        _file = path.empty() ? stdout : fopen(path.c_str(), "a");
+        if (!_file)
+        {
+            return false;
+        }
+        _policy.store(policy, std::memory_order_relaxed);
+        std::size_t capacity = 4096;
+        while (capacity < ring_capacity)
+        {
+            capacity <<= 1;
+        }
+        // Published to the logging threads by the release store of _started.
+        _ring_capacity.store(capacity, std::memory_order_relaxed);
+
+        _ns_per_tick = Tsc::Calibrate();
+        _base_tick = Tsc::Now();
+        _base_ns = RealtimeNs();
+
+        _stop.store(false, std::memory_order_relaxed);
+        auto backend_attributes = attributes;
+        if (backend_attributes._name.empty())
+        {
+            backend_attributes._name = "logger";
+        }
+        _backend = ThreadFactory::Create(backend_attributes, &Logger::Run, this);
+        _started.store(true, std::memory_order_release);
+        return true;
+    }
+
+    /**
+    * Write all the pending records and stop the background thread. Records logged concurrently with Stop() may
+    * be left in the rings until the next Start().
+    */
+    void Stop()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_started.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        _started.store(false, std::memory_order_release);
+        _stop.store(true, std::memory_order_release);
+        _backend.join();
+
+        // Records committed after the last pass of the background thread.
+        DrainRings();
+        if (_file != stdout)
+        {
+            fclose(_file);
+        }
+        else
+        {
+            fflush(_file);
+        }
+        _file = nullptr;
+    }
+
+    void SetLevel(LogLevel level)
+    {
+        _level.store(level, std::memory_order_relaxed);
+    }
+
+    /**
+    * Get the number of records dropped on full rings so far.
+    *
+    * @return Number of records dropped.
+    */
+    uint64_t GetDropNumber()
+    {
+        return _drop_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Count the {} placeholders of a format string, at compile time.
+    */
+    static constexpr std::size_t CountPlaceholders(const char *format)
+    {
+        std::size_t number = 0;
+        for (; *format; ++format)
+        {
+            if ((format[0] == '{') && (format[1] == '}'))
+            {
+                ++number;
+                ++format;
+            }
+        }
+        return number;
+    }
+
+    template <typename Tuple>
+    static constexpr LogSite MakeSite(LogLevel level, const char *file, int line, const char *format)
+    {
+        return LogSite{level, file, line, format, &FormatArgs<Tuple>};
+    }
+
+    template <typename... Args>
+    void Log(const LogSite &site, const Args&... args)
+    {
+        if (site._level < _level.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        auto size = sizeof(RecordHeader) + (static_cast<std::size_t>(0) + ... + ArgCodec<typename std::decay<Args>::type>::Size(args));
+        if (UNLIKELY(!_started.load(std::memory_order_acquire)))
+        {
+            LogSynchronously(site, size, args...);
+            return;
+        }
+
+        auto *ring = GetRing();
+        if (UNLIKELY(size > ring->GetCapacity() / 2))
+        {
+            // Would never fit.
+            _drop_count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto *record = ring->Reserve(size);
+        while (UNLIKELY(!record))
+        {
+            if ((_policy.load(std::memory_order_relaxed) == FullPolicy::drop) || !_started.load(std::memory_order_acquire))
+            {
+                _drop_count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            std::this_thread::yield();
+            record = ring->Reserve(size);
+        }
+
+        Encode(record, site, Tsc::Now(), size, args...);
+        ring->Commit(size);
+    }
+
+private:
+    struct RecordHeader
+    {
+        const LogSite *_site; // nullptr for padding up to the end of the ring.
+        uint64_t _tick;
+        uint64_t _size;
+    };
+
+    //
+    // Encoding of the arguments in the ring, by type.
+    //
+    template <typename T, typename = void>
+    struct ArgCodec
+    {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                      "Unsupported log argument type, use arithmetic, enum, pointer or string types");
+
+        static std::size_t Size(const T&)
+        {
+            return sizeof(T);
+        }
+
+        static void Encode(char *&p, const T &v)
+        {
+            std::memcpy(p, &v, sizeof(T));
+            p += sizeof(T);
+        }
+
+        static void Decode(const char *&p, std::string &out)
+        {
+            T v;
+            std::memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            if constexpr (std::is_same<T, bool>::value)
+            {
+                out.append(v ? "true" : "false");
+            }
+            else if constexpr (std::is_same<T, char>::value)
+            {
+                out.push_back(v);
+            }
+            else if constexpr (std::is_enum<T>::value)
+            {
+                out.append(std::to_string(static_cast<typename std::underlying_type<T>::type>(v)));
+            }
+            else if constexpr (std::is_pointer<T>::value)
+            {
+                char buff[32];
+                snprintf(buff, sizeof(buff), "%p", static_cast<const void*>(v));
+                out.append(buff);
+            }
+            else
+            {
+                out.append(std::to_string(v));
+            }
+        }
+    };
+
+    // Strings are copied, as they may be gone by the time the record is formatted.
+    struct StringCodec
+    {
+        static std::size_t Size(std::string_view v)
+        {
+            return sizeof(uint32_t) + std::min(v.size(), MAX_STRING_SIZE);
+        }
+
+        static void Encode(char *&p, std::string_view v)
+        {
+            uint32_t size = static_cast<uint32_t>(std::min(v.size(), MAX_STRING_SIZE));
+            std::memcpy(p, &size, sizeof(size));
+            std::memcpy(p + sizeof(size), v.data(), size);
+            p += sizeof(size) + size;
+        }
+
+        static void Decode(const char *&p, std::string &out)
+        {
+            uint32_t size;
+            std::memcpy(&size, p, sizeof(size));
+            out.append(p + sizeof(size), size);
+            p += sizeof(size) + size;
+        }
+    };
+
+    template <typename T>
+    struct ArgCodec<T, typename std::enable_if<std::is_same<T, const char*>::value || std::is_same<T, char*>::value>::type> : StringCodec
+    {
+        static std::size_t Size(const char *v)
+        {
+            return StringCodec::Size(v ? std::string_view(v) : std::string_view("(null)"));
+        }
+
+        static void Encode(char *&p, const char *v)
+        {
+            StringCodec::Encode(p, v ? std::string_view(v) : std::string_view("(null)"));
+        }
+    };
+
+    template <typename T>
+    struct ArgCodec<T, typename std::enable_if<std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value>::type> : StringCodec
+    {
+    };
+
+    //
+    // Ring of one logging thread, variable-size records. Single producer (the logging thread), single consumer
+    // (the background thread, or Stop()).
+    //
+    class LogRing
+    {
+    public:
+        explicit LogRing(std::size_t capacity) : _buffer(new char[capacity]), _capacity(capacity)
+        {
+        }
+
+        char* Reserve(std::size_t size)
+        {
+            size = Align(size);
+            auto write = _write.load(std::memory_order_relaxed);
+            auto pos = write & (_capacity - 1);
+            // Records never wrap, skip the end of the ring if the record doesn't fit in it.
+            auto skip = (_capacity - pos < size) ? _capacity - pos : 0;
+            if (write + skip + size - _read_cache > _capacity)
+            {
+                _read_cache = _read.load(std::memory_order_acquire);
+                if (write + skip + size - _read_cache > _capacity)
+                {
+                    return nullptr;
+                }
+            }
+
+            if (skip)
+            {
+                if (skip >= sizeof(RecordHeader))
+                {
+                    auto *padding = reinterpret_cast<RecordHeader*>(&_buffer[pos]);
+                    padding->_site = nullptr;
+                    padding->_size = skip;
+                }
+                _write.store(write + skip, std::memory_order_release);
+                pos = 0;
+            }
+            return &_buffer[pos];
+        }
+
+        void Commit(std::size_t size)
+        {
+            _write.store(_write.load(std::memory_order_relaxed) + Align(size), std::memory_order_release);
+        }
+
+        /**
+        * Read all the records committed so far.
+        *
+        * @param func Called with the header of each record, followed by its arguments.
+        * @return Number of records read.
+        */
+        template <typename Func>
+        std::size_t Drain(Func &&func)
+        {
+            std::size_t number = 0;
+            auto read = _read.load(std::memory_order_relaxed);
+            auto write = _write.load(std::memory_order_acquire);
+            while (read != write)
+            {
+                auto pos = read & (_capacity - 1);
+                if (_capacity - pos < sizeof(RecordHeader))
+                {
+                    read += _capacity - pos;
+                    continue;
+                }
+                auto *header = reinterpret_cast<const RecordHeader*>(&_buffer[pos]);
+                if (header->_site)
+                {
+                    func(*header);
+                    ++number;
+                }
+                read += Align(header->_size);
+            }
+            _read.store(read, std::memory_order_release);
+            return number;
+        }
+
+        void Close()
+        {
+            _closed.store(true, std::memory_order_release);
+        }
+
+        std::size_t GetCapacity() const
+        {
+            return _capacity;
+        }
+
+        bool IsClosed()
+        {
+            return _closed.load(std::memory_order_acquire);
+        }
+
+    private:
+        static std::size_t Align(std::size_t size)
+        {
+            return (size + alignof(RecordHeader) - 1) & ~(alignof(RecordHeader) - 1);
+        }
+
+        std::unique_ptr<char[]> _buffer;
+        std::size_t _capacity;
+        std::atomic<bool> _closed{false};
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write{0};
+        std::size_t _read_cache{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _read{0};
+    };
+
+    // Hands the ring over to the background thread when the logging thread exits.
+    struct RingHolder
+    {
+        ~RingHolder()
+        {
+            if (_ring)
+            {
+                _ring->Close();
+            }
+        }
+
+        LogRing *_ring{nullptr};
+    };
+
+    Logger() = default;
+
+    LogRing* GetRing()
+    {
+        static thread_local RingHolder holder;
+        // Read by the logging threads while a restart may change it.
+        auto capacity = _ring_capacity.load(std::memory_order_relaxed);
+        if (UNLIKELY(!holder._ring || (holder._ring->GetCapacity() != capacity)))
+        {
+            // Once per thread, or after a Start() with another capacity. The rings are owned by the logger, a
+            // replaced one is closed and reclaimed by the background thread once drained.
+            if (holder._ring)
+            {
+                holder._ring->Close();
+            }
+            std::lock_guard<std::mutex> guard(_rings_mutex);
+            _rings.emplace_back(new LogRing(capacity));
+            holder._ring = _rings.back().get();
+        }
+        return holder._ring;
+    }
+
+    template <typename... Args>
+    static void Encode(char *p, const LogSite &site, uint64_t tick, std::size_t size, const Args&... args)
+    {
+        auto *header = reinterpret_cast<RecordHeader*>(p);
+        header->_site = &site;
+        header->_tick = tick;
+        header->_size = size;
+        p += sizeof(RecordHeader);
+        (ArgCodec<typename std::decay<Args>::type>::Encode(p, args), ...);
+    }
+
+    template <typename Tuple>
+    static void FormatArgs(const char *format, const char *args, std::string &out)
+    {
+        FormatTuple(format, args, out, static_cast<Tuple*>(nullptr));
+    }
+
+    template <typename... Args>
+    static void FormatTuple(const char *format, [[maybe_unused]] const char *args, std::string &out, std::tuple<Args...>*)
+    {
+        // Both unused when the site has no arguments.
+        [[maybe_unused]] auto next = [&format, &out]() {
+            for (; *format; ++format)
+            {
+                if ((format[0] == '{') && (format[1] == '}'))
+                {
+                    format += 2;
+                    return;
+                }
+                out.push_back(*format);
+            }
+        };
+        (static_cast<void>((next(), ArgCodec<Args>::Decode(args, out))), ...);
+        out.append(format);
+    }
+
+    template <typename... Args>
+    void LogSynchronously(const LogSite &site, std::size_t size, const Args&... args)
+    {
+        std::string record(size, '\0');
+        Encode(&record[0], site, 0, size, args...);
+        std::string line;
+        FormatRecord(*reinterpret_cast<const RecordHeader*>(record.data()), RealtimeNs(), line);
+        fwrite(line.data(), 1, line.size(), stdout);
+        fflush(stdout);
+    }
+
+    static uint64_t RealtimeNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static void FormatRecord(const RecordHeader &header, uint64_t time_ns, std::string &line)
+    {
+        static const char *LEVELS[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+        time_t seconds = static_cast<time_t>(time_ns / 1000000000ULL);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char prefix[64];
+        auto n = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(prefix + n, sizeof(prefix) - n, ".%09llu ", static_cast<unsigned long long>(time_ns % 1000000000ULL));
+        line.append(prefix);
+
+        auto &site = *header._site;
+        auto *file = strrchr(site._file, '/');
+        line.append(LEVELS[static_cast<int>(site._level)]).append(" ").append(file ? file + 1 : site._file)
+            .append(":").append(std::to_string(site._line)).append(" ");
+        site._format_args(site._format, reinterpret_cast<const char*>(&header + 1), line);
+        line.push_back('\n');
+    }
+
+    void Run()
+    {
+        while (!_stop.load(std::memory_order_acquire))
+        {
+            if (DrainRings() == 0)
+            {
+                fflush(_file);
+                std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP_US));
+            }
+        }
+    }
+
+    std::size_t DrainRings()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_rings_mutex);
+            _drain_rings.clear();
+            for (auto &ring : _rings)
+            {
+                _drain_rings.push_back(ring.get());
+            }
+        }
+
+        std::size_t number = 0;
+        bool closed = false;
+        for (auto *&ring : _drain_rings)
+        {
+            // A ring closed before being drained is empty after, its thread is gone.
+            auto ring_closed = ring->IsClosed();
+            number += ring->Drain([this](const RecordHeader &header) {
+                _line.clear();
+                FormatRecord(header, _base_ns + static_cast<uint64_t>((header._tick - _base_tick) * _ns_per_tick), _line);
+                fwrite(_line.data(), 1, _line.size(), _file);
+            });
+            if (!ring_closed)
+            {
+                ring = nullptr;
+            }
+            closed |= ring_closed;
+        }
+
+        auto drop_count = _drop_count.load(std::memory_order_relaxed);
+        if (drop_count != _reported_drop_count)
+        {
+            fprintf(_file, "Dropped %llu log records on full rings\n", static_cast<unsigned long long>(drop_count - _reported_drop_count));
+            _reported_drop_count = drop_count;
+        }
+
+        if (closed)
+        {
+            // Only the drained closed rings are left in _drain_rings.
+            std::lock_guard<std::mutex> guard(_rings_mutex);
+            _rings.erase(std::remove_if(_rings.begin(), _rings.end(), [this](const std::unique_ptr<LogRing> &ring) {
+                return std::find(_drain_rings.begin(), _drain_rings.end(), ring.get()) != _drain_rings.end();
+            }), _rings.end());
+        }
+        return number;
+    }
+
+    std::atomic<bool> _started{false};
+    std::atomic<LogLevel> _level{LogLevel::info};
+    std::atomic<FullPolicy> _policy{FullPolicy::drop};
+    std::atomic<std::size_t> _ring_capacity{DEFAULT_RING_CAPACITY};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _drop_count{0};
+
+    // Start()/Stop()
+    std::mutex _mutex;
+    std::thread _backend;
+    std::atomic<bool> _stop{false};
+
+    std::mutex _rings_mutex;
+    std::vector<std::unique_ptr<LogRing>> _rings;
+
+    // Only used by the background thread.
+    std::vector<LogRing*> _drain_rings;
+    std::string _line;
+    std::FILE *_file{nullptr};
+    uint64_t _reported_drop_count{0};
+    double _ns_per_tick{1.0};
+    uint64_t _base_tick{0};
+    uint64_t _base_ns{0};
+};
+
+}} // namespace utils::leopard
+
+#define LEOPARD_LOG(level, format, ...)                                                                                 \
+    do                                                                                                                  \
+    {                                                                                                                   \
+        static_assert(::leopard::utils::Logger::CountPlaceholders(format) ==                                            \
+                      std::tuple_size<decltype(std::make_tuple(__VA_ARGS__))>::value,                                   \
+                      "Number of {} in the log format doesn't match the number of arguments");                         \
+        static constexpr ::leopard::utils::LogSite leopard_log_site =                                                   \
+            ::leopard::utils::Logger::MakeSite<decltype(std::make_tuple(__VA_ARGS__))>(level, __FILE__, __LINE__, format); \
+        ::leopard::utils::Logger::GetInstance().Log(leopard_log_site, ##__VA_ARGS__);                                   \
+    }                                                                                                                   \
+    while (0)
+
+#define LEOPARD_LOG_DEBUG(format, ...) LEOPARD_LOG(::leopard::utils::LogLevel::debug, format, ##__VA_ARGS__)
+#define LEOPARD_LOG_INFO(format, ...) LEOPARD_LOG(::leopard::utils::LogLevel::info, format, ##__VA_ARGS__)
+#define LEOPARD_LOG_WARN(format, ...) LEOPARD_LOG(::leopard::utils::LogLevel::warn, format, ##__VA_ARGS__)
+#define LEOPARD_LOG_ERROR(format, ...) LEOPARD_LOG(::leopard::utils::LogLevel::error, format, ##__VA_ARGS__)
+
+#endif // LEOPARD_UTILS_LOGGER_HXX_
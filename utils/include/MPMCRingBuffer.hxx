@@ -2,9 +2,12 @@
 #define LEOPARD_UTILS_MPMCRINGBUFFER_HXX_
 
 #include <Common.hxx>
+#include <Logger.hxx>
 #include <Math.hxx>
 
+#include <algorithm>
 #include <atomic>
+#include <limits>
 #include <mutex>
 #include <vector>
 
@@ -14,6 +17,51 @@ template <typename T>
 class MPMCRingBuffer
 {
 public:
+    //
+    // - A run of consecutive slots claimed by one batch call.
+    // - The run may wrap around the end of the ring-buffer, so always access the slots through operator[].
+    //
+    template <typename Msg>
+    class Batch
+    {
+    public:
+        Batch() = default;
+
+        Batch(Msg *base, std::size_t mask, std::size_t seq, std::size_t size)
+            : _base(base), _mask(mask), _seq(seq), _size(size)
+        {
+        }
+
+        Msg& operator[](std::size_t i) const
+        {
+            return _base[(_seq + i) & _mask];
+        }
+
+        std::size_t GetSeq() const
+        {
+            return _seq;
+        }
+
+        std::size_t GetSize() const
+        {
+            return _size;
+        }
+
+        bool IsEmpty() const
+        {
+            return _size == 0;
+        }
+
+    private:
+        Msg *_base{nullptr};
+        std::size_t _mask{0};
+        std::size_t _seq{0};
+        std::size_t _size{0};
+    };
+
+    using WriteBatch = Batch<T>;
+    using ReadBatch = Batch<const T>;
+
     /**
     * Initialize the ring-buffer to a certain capacity (num of slots) based on a suggested value.
     *
@@ -27,12 +75,12 @@ public:
 
         if (!_capacity.compare_exchange_strong(expected, actual_capacity))
         {
-            std::cout << "Buffer already initialized: capacity=" << _capacity.load(std::memory_order_acquire);
+            LEOPARD_LOG_WARN("Buffer already initialized: capacity={}", _capacity.load(std::memory_order_acquire));
             return false;
         }
 
         _buffer.resize(actual_capacity);
-        std::cout << "Buffer initialized: capacity=" << _capacity.load(std::memory_order_acquire);
+        LEOPARD_LOG_INFO("Buffer initialized: capacity={}", _capacity.load(std::memory_order_acquire));
         return true;
     }
 
@@ -137,6 +185,95 @@ public:
         _read_commit_count.fetch_add(1, std::memory_order_release);
     }
 
+    /**
+    * Try to get up to n consecutive ring-buffer slots for equeuing messages, with a single atomic operation.
+    *
+    * @param n Max number of slots wanted.
+    * @return Batch of the reserved slots, which holds fewer than n slots if the queue is nearly full
+    *         and is empty if the queue is full.
+    */
+    WriteBatch GetMessagesForWrite(std::size_t n)
+    {
+        auto write_ctr_snapshot = _write_reserve_count.load(std::memory_order_acquire);
+        auto read_ctr_snapshot = _read_commit_count.load(std::memory_order_acquire);
+        std::size_t number = 0;
+
+        do
+        {
+            // Same as the single slot version, fail fast against the read counter snapshot.
+            if (UNLIKELY(IsFull(write_ctr_snapshot, read_ctr_snapshot)))
+            {
+                return WriteBatch();
+            }
+            number = std::min(n, _capacity.load(std::memory_order_acquire) - (write_ctr_snapshot - read_ctr_snapshot));
+        }
+        while (!_write_reserve_count.compare_exchange_weak(write_ctr_snapshot, write_ctr_snapshot + number, std::memory_order_release));
+
+        WriteBatch rst(_buffer.data(), _capacity.load(std::memory_order_acquire) - 1, write_ctr_snapshot, number);
+        for (std::size_t i = 0; i < number; ++i)
+        {
+            rst[i]._seq = write_ctr_snapshot + i;
+            rst[i]._data_pointers.resize(0);
+        }
+        return rst;
+    }
+
+    /**
+    * Commit enqueuing a batch of messages to the ring-buffer.
+    *
+    * @param batch Batch returned by GetMessagesForWrite().
+    */
+    void CommitMessagesWrite(const WriteBatch &batch)
+    {
+        if (batch.IsEmpty())
+        {
+            return;
+        }
+        while (_write_commit_count.load(std::memory_order_acquire) < batch.GetSeq()) {}
+        _write_commit_count.fetch_add(batch.GetSize(), std::memory_order_release);
+    }
+
+    /**
+    * Try to read up to n messages from the ring-buffer before dequeuing, with a single atomic operation.
+    *
+    * @param n Max number of messages wanted, by default drain all the committed messages.
+    * @return Batch of the reserved messages, which is empty if the queue is empty.
+    */
+    ReadBatch GetMessagesForRead(std::size_t n = std::numeric_limits<std::size_t>::max())
+    {
+        auto write_ctr_snapshot = _write_commit_count.load(std::memory_order_acquire);
+        auto read_ctr_snapshot = _read_reserve_count.load(std::memory_order_acquire);
+        std::size_t number = 0;
+
+        do
+        {
+            // Same as the single slot version, fail fast against the write counter snapshot.
+            if (IsEmpty(write_ctr_snapshot, read_ctr_snapshot))
+            {
+                return ReadBatch();
+            }
+            number = std::min(n, write_ctr_snapshot - read_ctr_snapshot);
+        }
+        while (!_read_reserve_count.compare_exchange_weak(read_ctr_snapshot, read_ctr_snapshot + number, std::memory_order_release));
+
+        return ReadBatch(_buffer.data(), _capacity.load(std::memory_order_acquire) - 1, read_ctr_snapshot, number);
+    }
+
+    /**
+    * Commit dequeuing a batch of messages from the ring-buffer.
+    *
+    * @param batch Batch returned by GetMessagesForRead().
+    */
+    void CommitMessagesRead(const ReadBatch &batch)
+    {
+        if (batch.IsEmpty())
+        {
+            return;
+        }
+        while (_read_commit_count.load(std::memory_order_acquire) < batch.GetSeq()) {}
+        _read_commit_count.fetch_add(batch.GetSize(), std::memory_order_release);
+    }
+
 private:
     ALWAYS_INLINE std::size_t GetPos(std::size_t count)
     {
@@ -161,10 +298,12 @@ private:
 
     std::vector<T> _buffer;
     std::atomic<std::size_t> _capacity{0};
-    std::atomic<std::size_t> _write_reserve_count{0};
-    std::atomic<std::size_t> _write_commit_count{0};
-    std::atomic<std::size_t> _read_reserve_count{0};
-    std::atomic<std::size_t> _read_commit_count{0};
+
+    // Each counter is written by a different group of threads, so keep them on separate cache lines.
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write_reserve_count{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write_commit_count{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _read_reserve_count{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _read_commit_count{0};
 };
 
 }} // namespace utils::leopard
@@ -0,0 +1,181 @@
+#ifndef LEOPARD_UTILS_MPMCSEQRINGBUFFER_HXX_
+#define LEOPARD_UTILS_MPMCSEQRINGBUFFER_HXX_
+
+#include <Common.hxx>
+#include <Logger.hxx>
+#include <Math.hxx>
+
+#include <atomic>
+#include <memory>
+
+namespace leopard { namespace utils {
+
+//
+// - Bounded MPMC queue with a sequence number per slot (Vyukov style).
+// - Same Get/Commit interface as MPMCRingBuffer, but a commit only publishes its own slot and never
+//   waits for other producers/consumers to commit first. So a thread preempted between get and commit
+//   only blocks the slot it holds, not the whole queue.
+//
+template <typename T>
+class MPMCSeqRingBuffer
+{
+public:
+    /**
+    * Initialize the ring-buffer to a certain capacity (num of slots) based on a suggested value.
+    *
+    * @param capacity Suggested ring-buffer capacity. It will be rounded to the power of 2 upwards to apply.
+    * @return True if the ring-buffer is initialized successfully, false if it has already been initialized.
+    */
+    bool Init(std::size_t capacity)
+    {
+        std::size_t expected = 0;
+        auto actual_capacity = Math::NextPowerOf2(capacity);
+
+        if (!_capacity.compare_exchange_strong(expected, actual_capacity))
+        {
+            LEOPARD_LOG_WARN("Buffer already initialized: capacity={}", _capacity.load(std::memory_order_acquire));
+            return false;
+        }
+
+        _slots.reset(new Slot[actual_capacity]);
+        for (std::size_t i = 0; i < actual_capacity; ++i)
+        {
+            _slots[i]._turn.store(i, std::memory_order_relaxed);
+        }
+        _mask = actual_capacity - 1;
+        std::atomic_thread_fence(std::memory_order_release);
+        LEOPARD_LOG_INFO("Buffer initialized: capacity={}", _capacity.load(std::memory_order_acquire));
+        return true;
+    }
+
+    /**
+    * Get the ring-buffer capacity.
+    *
+    * @return Current capcacity of the ring-buffer.
+    */
+    std::size_t GetCapacity()
+    {
+        return _capacity.load(std::memory_order_acquire);
+    }
+
+    /**
+    * Get current message count in the ring-buffer.
+    *
+    * @return Number of slots reserved by producers but not yet reserved by consumers. Slots still being
+    *         written are included, so the value is only an approximation while producers are active.
+    */
+    std::size_t GetMessageNumber()
+    {
+        auto read_ctr_snapshot = _read_count.load(std::memory_order_acquire);
+        auto write_ctr_snapshot = _write_count.load(std::memory_order_acquire);
+        return write_ctr_snapshot > read_ctr_snapshot ? write_ctr_snapshot - read_ctr_snapshot : 0;
+    }
+
+    /**
+    * Try to get a ring-buffer slot for equeuing a message.
+    *
+    * @return Pointer to the available ring-buffer slot if the queue is not full, nullptr otherwise.
+    */
+    T* GetMessageForWrite()
+    {
+        auto write_ctr_snapshot = _write_count.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = _slots[write_ctr_snapshot & _mask];
+            auto turn = slot._turn.load(std::memory_order_acquire);
+
+            if (turn == write_ctr_snapshot)
+            {
+                if (_write_count.compare_exchange_weak(write_ctr_snapshot, write_ctr_snapshot + 1, std::memory_order_relaxed))
+                {
+                    slot._msg._seq = write_ctr_snapshot;
+                    slot._msg._data_pointers.resize(0);
+                    return &slot._msg;
+                }
+            }
+            else if (turn < write_ctr_snapshot)
+            {
+                // The slot still holds a message from the previous lap, so the queue is full.
+                return nullptr;
+            }
+            else
+            {
+                // Another producer has taken this slot, catch up and try again.
+                write_ctr_snapshot = _write_count.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+    * Commit enqueuing a message to the ring-buffer.
+    *
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageWrite(const T *msg)
+    {
+        _slots[msg->_seq & _mask]._turn.store(msg->_seq + 1, std::memory_order_release);
+    }
+
+    /**
+    * Try to read a message from the ring-buffer before dequeuing.
+    *
+    * @return Pointer to the ring-buffer tail slot if the queue is not empty, nullptr otherwise.
+    */
+    const T* GetMessageForRead()
+    {
+        auto read_ctr_snapshot = _read_count.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = _slots[read_ctr_snapshot & _mask];
+            auto turn = slot._turn.load(std::memory_order_acquire);
+
+            if (turn == read_ctr_snapshot + 1)
+            {
+                if (_read_count.compare_exchange_weak(read_ctr_snapshot, read_ctr_snapshot + 1, std::memory_order_relaxed))
+                {
+                    return &slot._msg;
+                }
+            }
+            else if (turn < read_ctr_snapshot + 1)
+            {
+                // The slot has not been committed by its producer yet, so nothing is ready to read.
+                return nullptr;
+            }
+            else
+            {
+                // Another consumer has taken this slot, catch up and try again.
+                read_ctr_snapshot = _read_count.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+    * Commit dequeuing a message from the ring-buffer.
+    *
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageRead(const T *msg)
+    {
+        _slots[msg->_seq & _mask]._turn.store(msg->_seq + _mask + 1, std::memory_order_release);
+    }
+
+private:
+    struct Slot
+    {
+        // Equal to the write counter value when the slot is free for that write, write counter + 1
+        // once the message is committed, and it then moves one lap (capacity) ahead after the read.
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _turn{0};
+        T _msg;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask{0};
+    std::atomic<std::size_t> _capacity{0};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write_count{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _read_count{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_MPMCSEQRINGBUFFER_HXX_
\ No newline at end of file
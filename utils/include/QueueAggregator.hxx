@@ -0,0 +1,188 @@
+#ifndef LEOPARD_UTILS_QUEUEAGGREGATOR_HXX_
+#define LEOPARD_UTILS_QUEUEAGGREGATOR_HXX_
+
+#include "Delegate.hxx"
+#include "FdAggregator.hxx"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace leopard { namespace utils {
+
+//
+// - Aggregator draining a queue (MPMCRingBuffer, MPMCSeqRingBuffer, SPSCRingBuffer...) inside Reactor::Run(),
+//   so that other threads can hand messages or closures to the reactor thread without locks.
+// - At most a budget of messages is handled per pass, so a busy queue can't starve the other aggregators.
+// - Optional eventfd doorbell: it's rung only when a producer finds the reactor idle on an empty queue,
+//   so that a reactor blocking in epoll wakes up, while a busy queue costs no syscall.
+// - The queue is owned by the aggregator, initialize it through GetQueue() if it needs to (e.g. MPMCRingBuffer::Init()).
+//
+template <typename Queue>
+class QueueAggregator
+{
+public:
+    using Message = typename std::remove_pointer<decltype(std::declval<Queue&>().GetMessageForWrite())>::type;
+    using Handler = Delegate<void(const Message&)>;
+
+    static constexpr std::size_t DEFAULT_DRAIN_BUDGET{64};
+
+    QueueAggregator() = default;
+    QueueAggregator(const QueueAggregator&) = delete;
+    QueueAggregator& operator = (const QueueAggregator&) = delete;
+
+    ~QueueAggregator()
+    {
+        if (_doorbell_fd != -1)
+        {
+            close(_doorbell_fd);
+        }
+    }
+
+    Queue& GetQueue()
+    {
+        return _queue;
+    }
+
+    /**
+    * Set the handler called on the reactor thread for each message.
+    *
+    * @param handler The message handler.
+    */
+    void SetQueueHandler(Handler handler)
+    {
+        _handler = std::move(handler);
+    }
+
+    /**
+    * Set the max number of messages handled per reactor pass.
+    *
+    * @param budget Max number of messages per pass, 0 for no limit.
+    */
+    void SetDrainBudget(std::size_t budget)
+    {
+        _budget = budget;
+    }
+
+    /**
+    * Create the doorbell eventfd. Register it to whatever the reactor blocks on, and call ClearDoorbell() when it's readable.
+    *
+    * @return The doorbell eventfd.
+    */
+    int EnableDoorbell()
+    {
+        if (_doorbell_fd == -1)
+        {
+            _doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_doorbell_fd == -1)
+            {
+                throw std::system_error(errno, std::system_category(), std::string("Failed to create doorbell: ").append(strerror(errno)).c_str());
+            }
+        }
+        return _doorbell_fd;
+    }
+
+    /**
+    * Create the doorbell eventfd and register it to a FdAggregator, typically the one of the same reactor.
+    *
+    * @param aggregator The FdAggregator to register the doorbell to.
+    * @return True if the doorbell is registered successfully, false otherwise.
+    */
+    bool EnableDoorbell(FdAggregator &aggregator)
+    {
+        return aggregator.AddFd(EnableDoorbell(), EPOLLIN, [this](){ ClearDoorbell(); }, [](){});
+    }
+
+    /**
+    * Reset the doorbell eventfd to non-readable.
+    */
+    void ClearDoorbell()
+    {
+        uint64_t value;
+        while (read(_doorbell_fd, &value, sizeof(value)) == sizeof(value)) {}
+    }
+
+    /**
+    * Enqueue a message for the reactor thread. Thread safe if the queue supports multiple producers.
+    *
+    * @param fill Called with the queue slot to fill in the message.
+    * @return True if the message is enqueued, false if the queue is full.
+    */
+    template <typename Fill>
+    bool Post(Fill &&fill)
+    {
+        auto *msg = _queue.GetMessageForWrite();
+        if (UNLIKELY(!msg))
+        {
+            return false;
+        }
+        fill(*msg);
+        _queue.CommitMessageWrite(msg);
+
+        // Pairs with the fence in CollectEvents(), either the reactor sees the message or we see it idle.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (UNLIKELY(_idle.load(std::memory_order_relaxed)) && _idle.exchange(false, std::memory_order_acq_rel))
+        {
+            uint64_t one = 1;
+            static_cast<void>(write(_doorbell_fd, &one, sizeof(one)));
+        }
+        return true;
+    }
+
+    /**
+    * Get how long the reactor may block without missing a message, used by Reactor.
+    *
+    * @return UINT64_MAX if producers will ring the doorbell on the next message, 0 otherwise.
+    */
+    uint64_t GetIdleTimeout()
+    {
+        return ((_doorbell_fd != -1) && _idle.load(std::memory_order_acquire)) ? UINT64_MAX : 0;
+    }
+
+protected:
+    std::size_t CollectEvents()
+    {
+        std::size_t number = 0;
+        while ((_budget == 0) || (number < _budget))
+        {
+            auto *msg = _queue.GetMessageForRead();
+            if (!msg)
+            {
+                break;
+            }
+            if (LIKELY(static_cast<bool>(_handler)))
+            {
+                _handler(*msg);
+            }
+            _queue.CommitMessageRead(msg);
+            ++number;
+        }
+
+        if ((number == 0) && (_doorbell_fd != -1) && !_idle.load(std::memory_order_relaxed))
+        {
+            // Tell producers to ring the doorbell, then check again for a message committed in between.
+            _idle.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_queue.GetMessageNumber() > 0)
+            {
+                _idle.store(false, std::memory_order_relaxed);
+            }
+        }
+        return number;
+    }
+
+private:
+    Queue _queue;
+    Handler _handler;
+    std::size_t _budget{DEFAULT_DRAIN_BUDGET};
+    int _doorbell_fd{-1};
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> _idle{false};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_QUEUEAGGREGATOR_HXX_
\ No newline at end of file
@@ -2,31 +2,245 @@
 #define LEOPARD_UTILS_REACTOR_HXX_
 
 #include "FdAggregator.hxx"
+#include "NonCopyable.hxx"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
 #include <atomic>
+#include <thread>
+#include <type_traits>
 
 namespace leopard { namespace utils {
 
+//
+// - What Reactor::Run() does after a pass where no aggregator handled any event.
+// - Blocking happens in the FdAggregator of the reactor, bounded by every aggregator's GetIdleTimeout(), e.g.
+//   the next timer of TimerWheelAggregator. An aggregator that can't wake up the reactor keeps it polling.
+// - A reactor without FdAggregator can't block, it yields instead.
+//
+struct WaitPolicy
+{
+    enum class Mode
+    {
+        spin,       // Poll again straight away.
+        spin_yield, // Poll for spin_ns, then yield the CPU after each empty poll.
+        spin_block, // Poll for spin_ns, then block up to block_timeout_ns.
+        block       // Block up to block_timeout_ns after each empty poll.
+    };
+
+    static WaitPolicy Spin()
+    {
+        return WaitPolicy{Mode::spin, 0, 0};
+    }
+
+    static WaitPolicy SpinYield(uint64_t spin_ns)
+    {
+        return WaitPolicy{Mode::spin_yield, spin_ns, 0};
+    }
+
+    static WaitPolicy SpinBlock(uint64_t spin_ns, uint64_t block_timeout_ns)
+    {
+        return WaitPolicy{Mode::spin_block, spin_ns, block_timeout_ns};
+    }
+
+    static WaitPolicy Block(uint64_t block_timeout_ns = UINT64_MAX)
+    {
+        return WaitPolicy{Mode::block, 0, block_timeout_ns};
+    }
+
+    Mode _mode{Mode::spin};
+    uint64_t _spin_ns{0};
+    uint64_t _block_timeout_ns{0};
+};
+
 template <typename... Aggregators>
 class Reactor : private NonCopyable, public Aggregators...
 {
 public:
+    Reactor()
+    {
+        if constexpr (HAS_FD_AGGREGATOR)
+        {
+            // Lets Stop() wake up a blocking reactor.
+            _wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_wakeup_fd == -1)
+            {
+                throw std::system_error(errno, std::system_category(), std::string("Failed to initialize Reactor: ").append(strerror(errno)).c_str());
+            }
+            FdAggregator::AddFd(_wakeup_fd, EPOLLIN, [this](){ uint64_t v; static_cast<void>(read(_wakeup_fd, &v, sizeof(v))); }, [](){});
+        }
+    }
+
+    ~Reactor()
+    {
+        if (_wakeup_fd != -1)
+        {
+            close(_wakeup_fd);
+        }
+    }
+
+    /**
+    * Set the wait policy. Call it before Run().
+    *
+    * @param policy The wait policy.
+    */
+    void SetWaitPolicy(const WaitPolicy &policy)
+    {
+        _policy = policy;
+    }
+
     void Run()
     {
+        uint64_t idle_since = 0;
         while (!_stop.load(std::memory_order::memory_order_acquire))
         {
-            (static_cast<void>(Aggregators::CollectEvents()), ...);
+            std::size_t number = 0;
+            (static_cast<void>(number += Aggregators::CollectEvents()), ...);
+
+            if (number)
+            {
+                _productive_polls.store(_productive_polls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                idle_since = 0;
+                continue;
+            }
+            _empty_polls.store(_empty_polls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+            switch (_policy._mode)
+            {
+                case WaitPolicy::Mode::spin:
+                    break;
+                case WaitPolicy::Mode::spin_yield:
+                    if (IsIdleFor(idle_since, _policy._spin_ns))
+                    {
+                        std::this_thread::yield();
+                    }
+                    break;
+                case WaitPolicy::Mode::spin_block:
+                    if (IsIdleFor(idle_since, _policy._spin_ns))
+                    {
+                        Block();
+                    }
+                    break;
+                case WaitPolicy::Mode::block:
+                    Block();
+                    break;
+            }
         }
     }
 
     void Stop()
     {
         _stop.store(true, std::memory_order_release);
+        if (_wakeup_fd != -1)
+        {
+            uint64_t one = 1;
+            static_cast<void>(write(_wakeup_fd, &one, sizeof(one)));
+        }
+    }
+
+    /**
+    * Get the number of passes where no aggregator handled any event.
+    *
+    * @return Number of empty polls.
+    */
+    uint64_t GetEmptyPollNumber()
+    {
+        return _empty_polls.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Get the number of passes where some aggregator handled events.
+    *
+    * @return Number of productive polls.
+    */
+    uint64_t GetProductivePollNumber()
+    {
+        return _productive_polls.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * Get the number of times the reactor blocked.
+    *
+    * @return Number of blocking waits.
+    */
+    uint64_t GetBlockNumber()
+    {
+        return _blocks.load(std::memory_order_relaxed);
     }
 
 private:
+    static constexpr bool HAS_FD_AGGREGATOR{(std::is_base_of<FdAggregator, Aggregators>::value || ...)};
+
+    template <typename Aggregator, typename = void>
+    struct HasIdleTimeout : std::false_type {};
+
+    template <typename Aggregator>
+    struct HasIdleTimeout<Aggregator, std::void_t<decltype(std::declval<Aggregator&>().GetIdleTimeout())>> : std::true_type {};
+
+    template <typename Aggregator>
+    uint64_t GetIdleTimeoutOf()
+    {
+        if constexpr (HasIdleTimeout<Aggregator>::value)
+        {
+            return Aggregator::GetIdleTimeout();
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    static uint64_t Now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    bool IsIdleFor(uint64_t &idle_since, uint64_t duration_ns)
+    {
+        auto now = Now();
+        if (idle_since == 0)
+        {
+            idle_since = now;
+        }
+        return now - idle_since >= duration_ns;
+    }
+
+    void Block()
+    {
+        if constexpr (HAS_FD_AGGREGATOR)
+        {
+            auto timeout = _policy._block_timeout_ns;
+            (static_cast<void>(timeout = std::min(timeout, GetIdleTimeoutOf<Aggregators>())), ...);
+            if ((timeout == 0) || _stop.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            _blocks.store(_blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (FdAggregator::WaitEvents(timeout))
+            {
+                _productive_polls.store(_productive_polls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
     std::atomic<bool> _stop{false};
+    WaitPolicy _policy;
+    int _wakeup_fd{-1};
+
+    // Only written by the reactor thread, atomic so that they can be read from other threads.
+    std::atomic<uint64_t> _empty_polls{0};
+    std::atomic<uint64_t> _productive_polls{0};
+    std::atomic<uint64_t> _blocks{0};
 };
 
 }} // namespace utils::leopard
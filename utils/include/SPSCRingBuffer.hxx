@@ -0,0 +1,123 @@
+#ifndef LEOPARD_UTILS_SPSCRINGBUFFER_HXX_
+#define LEOPARD_UTILS_SPSCRINGBUFFER_HXX_
+
+#include <Common.hxx>
+#include <NonCopyable.hxx>
+
+#include <atomic>
+#include <memory>
+
+namespace leopard { namespace utils {
+
+//
+// - Wait-free ring-buffer for exactly one producer thread and one consumer thread.
+// - Same Get/Commit interface as MPMCRingBuffer, but no requirement on the layout of T.
+// - Each side keeps a local copy of the other side's counter and only reloads the shared one when
+//   the copy says the queue is full/empty, so the counters' cache lines are rarely bounced.
+//
+template <typename T, std::size_t Capacity>
+class SPSCRingBuffer : private NonCopyable
+{
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity of SPSCRingBuffer must be a power of 2.");
+
+public:
+    SPSCRingBuffer() : _buffer(new T[Capacity])
+    {
+    }
+
+    /**
+    * Get the ring-buffer capacity.
+    *
+    * @return Capcacity of the ring-buffer.
+    */
+    static constexpr std::size_t GetCapacity()
+    {
+        return Capacity;
+    }
+
+    /**
+    * Get current message count in the ring-buffer.
+    *
+    * @return Current message count in the ring-buffer.
+    */
+    std::size_t GetMessageNumber()
+    {
+        auto read_ctr_snapshot = _read_count.load(std::memory_order_acquire);
+        return _write_count.load(std::memory_order_acquire) - read_ctr_snapshot;
+    }
+
+    /**
+    * Try to get a ring-buffer slot for equeuing a message. Producer thread only.
+    *
+    * @return Pointer to the available ring-buffer slot if the queue is not full, nullptr otherwise.
+    */
+    T* GetMessageForWrite()
+    {
+        auto write_ctr = _write_count.load(std::memory_order_relaxed);
+        if (UNLIKELY(write_ctr - _read_count_cache >= Capacity))
+        {
+            _read_count_cache = _read_count.load(std::memory_order_acquire);
+            if (write_ctr - _read_count_cache >= Capacity)
+            {
+                return nullptr;
+            }
+        }
+        return &_buffer[write_ctr & MASK];
+    }
+
+    /**
+    * Commit enqueuing the message got from the last GetMessageForWrite(). Producer thread only.
+    *
+    * @param msg Pointer of the committed message, kept for the same interface as MPMCRingBuffer.
+    */
+    void CommitMessageWrite(const T *)
+    {
+        _write_count.store(_write_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+    * Try to read a message from the ring-buffer before dequeuing. Consumer thread only.
+    *
+    * @return Pointer to the ring-buffer tail slot if the queue is not empty, nullptr otherwise.
+    */
+    const T* GetMessageForRead()
+    {
+        auto read_ctr = _read_count.load(std::memory_order_relaxed);
+        if (read_ctr == _write_count_cache)
+        {
+            _write_count_cache = _write_count.load(std::memory_order_acquire);
+            if (read_ctr == _write_count_cache)
+            {
+                return nullptr;
+            }
+        }
+        return &_buffer[read_ctr & MASK];
+    }
+
+    /**
+    * Commit dequeuing the message got from the last GetMessageForRead(). Consumer thread only.
+    *
+    * @param msg Pointer of the committed message, kept for the same interface as MPMCRingBuffer.
+    */
+    void CommitMessageRead(const T *)
+    {
+        _read_count.store(_read_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static constexpr std::size_t MASK{Capacity - 1};
+
+    std::unique_ptr<T[]> _buffer;
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _write_count{0};
+    std::size_t _read_count_cache{0};
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> _read_count{0};
+    std::size_t _write_count_cache{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_SPSCRINGBUFFER_HXX_
\ No newline at end of file
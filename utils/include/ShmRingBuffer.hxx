@@ -0,0 +1,405 @@
+#ifndef LEOPARD_UTILS_SHMRINGBUFFER_HXX_
+#define LEOPARD_UTILS_SHMRINGBUFFER_HXX_
+
+#include "Common.hxx"
+#include "Logger.hxx"
+#include "Math.hxx"
+#include "NonCopyable.hxx"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+
+namespace leopard { namespace utils {
+
+//
+// - Bounded MPMC queue between processes (e.g. a feed handler and the strategies), with the same Get/Commit
+//   interface and per-slot sequence numbers as MPMCSeqRingBuffer.
+// - The header, counters and slots all live in a named shared memory region: one process Create()s it, the
+//   others Attach() to it. Once mapped, enqueuing/dequeuing is plain loads/stores on shared memory, no syscall.
+// - T is copied into the region as raw bytes, so it must be trivially copyable and hold no pointers.
+// - The header records a layout version and the size/alignment/version of T, Attach() refuses a region built
+//   by an incompatible binary.
+// - The region outlives the processes, Remove() it once it's not used anymore.
+//
+template <typename T>
+class ShmRingBuffer : private NonCopyable
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T of ShmRingBuffer must be trivially copyable.");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRingBuffer requires lock-free 64-bit atomics.");
+
+public:
+    static constexpr uint64_t MAGIC{0x4c45504152445348}; // "LEPARDSH"
+    static constexpr uint32_t LAYOUT_VERSION{1};
+    static constexpr std::size_t HUGE_PAGE_SIZE{2 * 1024 * 1024};
+    static constexpr const char *HUGE_PAGE_DIR{"/dev/hugepages"};
+
+    ShmRingBuffer() = default;
+
+    // Unmaps the region, but doesn't remove it.
+    ~ShmRingBuffer()
+    {
+        Unmap();
+    }
+
+    /**
+    * Create a region and initialize the ring-buffer in it.
+    *
+    * @param name Name of the region, without '/'.
+    * @param capacity Suggested ring-buffer capacity. It will be rounded to the power of 2 upwards to apply.
+    * @param huge_page True to back the region by huge pages, from the hugetlbfs mounted at HUGE_PAGE_DIR if any,
+    *                  otherwise from transparent huge pages.
+    * @param type_version Version of the layout of T, to be given to Attach() as well.
+    * @return True if the ring-buffer is created successfully, false if the region already exists or on error.
+    */
+    bool Create(const std::string &name, std::size_t capacity, bool huge_page = false, uint32_t type_version = 0)
+    {
+        if (_header)
+        {
+            LEOPARD_LOG_WARN("Buffer already mapped: name={}", _name);
+            return false;
+        }
+
+        auto actual_capacity = Math::NextPowerOf2(capacity ? capacity : 1);
+        auto size = sizeof(Header) + actual_capacity * sizeof(Slot);
+        if (huge_page)
+        {
+            size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        }
+
+        int fd = -1;
+        if (huge_page)
+        {
+            fd = open(GetHugePagePath(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if ((fd < 0) && (errno == ENOENT))
+            {
+                LEOPARD_LOG_WARN("No hugetlbfs mounted, fall back to transparent huge pages: name={}, dir={}", name, HUGE_PAGE_DIR);
+                huge_page = false;
+            }
+        }
+        if (!huge_page)
+        {
+            fd = shm_open(GetShmName(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        if (fd < 0)
+        {
+            LEOPARD_LOG_ERROR("Failed to create shared memory: name={}, errno={}, err_text={}", name, errno, strerror(errno));
+            return false;
+        }
+        if ((ftruncate(fd, static_cast<off_t>(size)) != 0) || !Map(fd, size))
+        {
+            LEOPARD_LOG_ERROR("Failed to map shared memory: name={}, size={}, errno={}, err_text={}", name, size, errno, strerror(errno));
+            close(fd);
+            Remove(name);
+            return false;
+        }
+        close(fd);
+        if (!huge_page)
+        {
+            // Only effective if the shmem huge pages are enabled, see /sys/kernel/mm/transparent_hugepage/shmem_enabled.
+            static_cast<void>(madvise(_memory, _size, MADV_HUGEPAGE));
+        }
+
+        // Touch every page, so that the first messages don't fault.
+        auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        for (std::size_t offset = 0; offset < _size; offset += page_size)
+        {
+            static_cast<volatile char*>(_memory)[offset] = 0;
+        }
+
+        new (_header) Header();
+        _header->_magic = MAGIC;
+        _header->_layout_version = LAYOUT_VERSION;
+        _header->_type_version = type_version;
+        _header->_type_size = sizeof(T);
+        _header->_type_alignment = alignof(T);
+        _header->_slot_size = sizeof(Slot);
+        _header->_capacity = actual_capacity;
+        for (uint64_t i = 0; i < actual_capacity; ++i)
+        {
+            new (&_slots[i]) Slot();
+            _slots[i]._turn.store(i, std::memory_order_relaxed);
+        }
+        _mask = actual_capacity - 1;
+        _name = name;
+        // Publishes the initialized region to Attach().
+        _header->_ready.store(1, std::memory_order_release);
+        LEOPARD_LOG_INFO("Buffer created: name={}, capacity={}, size={}, huge_page={}", name, actual_capacity, _size, huge_page);
+        return true;
+    }
+
+    /**
+    * Attach to a region created by Create(), in this process or another one.
+    *
+    * @param name Name of the region, without '/'.
+    * @param type_version Version of the layout of T, as given to Create().
+    * @return True if attached, false if the region doesn't exist, isn't initialized yet or has an incompatible layout.
+    */
+    bool Attach(const std::string &name, uint32_t type_version = 0)
+    {
+        if (_header)
+        {
+            LEOPARD_LOG_WARN("Buffer already mapped: name={}", _name);
+            return false;
+        }
+
+        auto fd = shm_open(GetShmName(name).c_str(), O_RDWR, 0);
+        if ((fd < 0) && (errno == ENOENT))
+        {
+            fd = open(GetHugePagePath(name).c_str(), O_RDWR);
+        }
+        if (fd < 0)
+        {
+            LEOPARD_LOG_ERROR("Failed to open shared memory: name={}, errno={}, err_text={}", name, errno, strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (static_cast<std::size_t>(st.st_size) < sizeof(Header)))
+        {
+            LEOPARD_LOG_ERROR("Shared memory not initialized: name={}", name);
+            close(fd);
+            return false;
+        }
+        auto mapped = Map(fd, static_cast<std::size_t>(st.st_size));
+        close(fd);
+        if (!mapped)
+        {
+            LEOPARD_LOG_ERROR("Failed to map shared memory: name={}, errno={}, err_text={}", name, errno, strerror(errno));
+            return false;
+        }
+
+        if (!_header->_ready.load(std::memory_order_acquire))
+        {
+            LEOPARD_LOG_ERROR("Shared memory not initialized: name={}", name);
+            Unmap();
+            return false;
+        }
+        if ((_header->_magic != MAGIC) || (_header->_layout_version != LAYOUT_VERSION)
+            || (_header->_type_version != type_version) || (_header->_type_size != sizeof(T))
+            || (_header->_type_alignment != alignof(T)) || (_header->_slot_size != sizeof(Slot))
+            || (_header->_capacity == 0) || (_header->_capacity & (_header->_capacity - 1))
+            || (sizeof(Header) + _header->_capacity * sizeof(Slot) > _size))
+        {
+            LEOPARD_LOG_ERROR("Incompatible shared memory layout: name={}, layout_version={}, type_version={}, type_size={}, "
+                              "expected_layout_version={}, expected_type_version={}, expected_type_size={}",
+                              name, _header->_layout_version, _header->_type_version, _header->_type_size,
+                              LAYOUT_VERSION, type_version, sizeof(T));
+            Unmap();
+            return false;
+        }
+        _mask = _header->_capacity - 1;
+        _name = name;
+        LEOPARD_LOG_INFO("Buffer attached: name={}, capacity={}", name, _header->_capacity);
+        return true;
+    }
+
+    /**
+    * Remove a region. Processes still mapping it keep using it, it's freed after the last one unmaps it.
+    *
+    * @param name Name of the region, without '/'.
+    * @return True if the region existed.
+    */
+    static bool Remove(const std::string &name)
+    {
+        auto removed = (shm_unlink(GetShmName(name).c_str()) == 0);
+        removed = (unlink(GetHugePagePath(name).c_str()) == 0) || removed;
+        return removed;
+    }
+
+    /**
+    * Get the ring-buffer capacity.
+    *
+    * @return Capcacity of the ring-buffer, 0 if not created/attached.
+    */
+    std::size_t GetCapacity() const
+    {
+        return _header ? _mask + 1 : 0;
+    }
+
+    /**
+    * Get current message count in the ring-buffer.
+    *
+    * @return Number of slots reserved by producers but not yet reserved by consumers, approximate while
+    *         producers are active.
+    */
+    std::size_t GetMessageNumber() const
+    {
+        auto read_ctr_snapshot = _header->_read_count.load(std::memory_order_acquire);
+        auto write_ctr_snapshot = _header->_write_count.load(std::memory_order_acquire);
+        return write_ctr_snapshot > read_ctr_snapshot ? write_ctr_snapshot - read_ctr_snapshot : 0;
+    }
+
+    /**
+    * Try to get a ring-buffer slot for equeuing a message.
+    *
+    * @return Pointer to the available ring-buffer slot if the queue is not full, nullptr otherwise.
+    */
+    T* GetMessageForWrite()
+    {
+        auto write_ctr_snapshot = _header->_write_count.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = _slots[write_ctr_snapshot & _mask];
+            auto turn = slot._turn.load(std::memory_order_acquire);
+
+            if (turn == write_ctr_snapshot)
+            {
+                if (_header->_write_count.compare_exchange_weak(write_ctr_snapshot, write_ctr_snapshot + 1, std::memory_order_relaxed))
+                {
+                    slot._seq = write_ctr_snapshot;
+                    return &slot._msg;
+                }
+            }
+            else if (turn < write_ctr_snapshot)
+            {
+                // The slot still holds a message from the previous lap, so the queue is full.
+                return nullptr;
+            }
+            else
+            {
+                // Another producer has taken this slot, catch up and try again.
+                write_ctr_snapshot = _header->_write_count.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+    * Commit enqueuing a message to the ring-buffer.
+    *
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageWrite(const T *msg)
+    {
+        auto &slot = GetSlot(msg);
+        slot._turn.store(slot._seq + 1, std::memory_order_release);
+    }
+
+    /**
+    * Try to read a message from the ring-buffer before dequeuing.
+    *
+    * @return Pointer to the ring-buffer tail slot if the queue is not empty, nullptr otherwise.
+    */
+    const T* GetMessageForRead()
+    {
+        auto read_ctr_snapshot = _header->_read_count.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = _slots[read_ctr_snapshot & _mask];
+            auto turn = slot._turn.load(std::memory_order_acquire);
+
+            if (turn == read_ctr_snapshot + 1)
+            {
+                if (_header->_read_count.compare_exchange_weak(read_ctr_snapshot, read_ctr_snapshot + 1, std::memory_order_relaxed))
+                {
+                    return &slot._msg;
+                }
+            }
+            else if (turn < read_ctr_snapshot + 1)
+            {
+                // The slot has not been committed by its producer yet, so nothing is ready to read.
+                return nullptr;
+            }
+            else
+            {
+                // Another consumer has taken this slot, catch up and try again.
+                read_ctr_snapshot = _header->_read_count.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+    * Commit dequeuing a message from the ring-buffer.
+    *
+    * @param msg Pointer of the committed message.
+    */
+    void CommitMessageRead(const T *msg)
+    {
+        auto &slot = GetSlot(msg);
+        slot._turn.store(slot._seq + _mask + 1, std::memory_order_release);
+    }
+
+private:
+    // Fixed-width fields only, the region may be shared by binaries built with different compilers.
+    struct Header
+    {
+        uint64_t _magic{0};
+        uint32_t _layout_version{0};
+        uint32_t _type_version{0};
+        uint64_t _type_size{0};
+        uint64_t _type_alignment{0};
+        uint64_t _slot_size{0};
+        uint64_t _capacity{0};
+        std::atomic<uint32_t> _ready{0};
+
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _write_count{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _read_count{0};
+    };
+
+    struct Slot
+    {
+        // Same protocol as MPMCSeqRingBuffer, T has no _seq so the slot keeps the one of its message.
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _turn{0};
+        uint64_t _seq{0};
+        T _msg;
+    };
+
+    static std::string GetShmName(const std::string &name)
+    {
+        return "/" + name;
+    }
+
+    static std::string GetHugePagePath(const std::string &name)
+    {
+        return std::string(HUGE_PAGE_DIR) + "/" + name;
+    }
+
+    Slot& GetSlot(const T *msg)
+    {
+        auto offset = reinterpret_cast<const char*>(msg) - reinterpret_cast<const char*>(_slots);
+        return _slots[offset / sizeof(Slot)];
+    }
+
+    bool Map(int fd, std::size_t size)
+    {
+        auto *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+        _memory = memory;
+        _size = size;
+        _header = static_cast<Header*>(memory);
+        _slots = reinterpret_cast<Slot*>(static_cast<char*>(memory) + sizeof(Header));
+        return true;
+    }
+
+    void Unmap()
+    {
+        if (_memory)
+        {
+            munmap(_memory, _size);
+        }
+        _memory = nullptr;
+        _size = 0;
+        _header = nullptr;
+        _slots = nullptr;
+        _mask = 0;
+    }
+
+    void *_memory{nullptr};
+    std::size_t _size{0};
+    Header *_header{nullptr};
+    Slot *_slots{nullptr};
+    uint64_t _mask{0};
+    std::string _name;
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_SHMRINGBUFFER_HXX_
@@ -0,0 +1,153 @@
+#ifndef LEOPARD_UTILS_THREADFACTORY_HXX_
+#define LEOPARD_UTILS_THREADFACTORY_HXX_
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+//
+// - How a thread is set up by ThreadFactory, before it runs any user code.
+// - The default attributes leave the thread as std::thread does.
+//
+struct ThreadAttributes
+{
+    enum class NumaPolicy
+    {
+        none,         // Keep the process policy.
+        prefer_local, // Allocate on the node of the pinned CPU, fall back to other nodes when it's full.
+        bind_local    // Allocate on the node of the pinned CPU only.
+    };
+
+    std::vector<int> _cpus;                     // CPUs the thread may run on, empty for no affinity.
+    NumaPolicy _numa_policy{NumaPolicy::none};  // Only applied together with _cpus.
+    std::string _name;                          // Truncated to 15 chars, empty to inherit the creator's.
+    int _fifo_priority{0};                      // SCHED_FIFO priority (1-99), 0 to keep SCHED_OTHER.
+};
+
+//
+// - Creates threads pinned, NUMA bound, named and prioritized before the user function runs, so that it never
+//   runs with the wrong settings.
+// - Create() returns once the thread is set up, and throws std::system_error (the thread has exited by then)
+//   if any attribute can't be applied, e.g. SCHED_FIFO without CAP_SYS_NICE.
+// - Hand the thread over to ThreadRAII to have it joined/detached on scope exit.
+//
+class ThreadFactory
+{
+public:
+    template <typename F, typename... Args>
+    static std::thread Create(const ThreadAttributes &attributes, F &&f, Args&&... args)
+    {
+        // Error number and text of the setup, errno itself is per thread.
+        std::promise<std::pair<int, std::string>> setup;
+        auto setup_done = setup.get_future();
+        auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+
+        std::thread t([&attributes, &setup, func = std::move(func)]() mutable {
+            auto err = Apply(attributes);
+            auto ok = err.empty();
+            // Nothing of the creator's can be touched after this, it may have returned.
+            setup.set_value(std::make_pair(ok ? 0 : errno, std::move(err)));
+            if (ok)
+            {
+                func();
+            }
+        });
+
+        auto rst = setup_done.get();
+        if (!rst.second.empty())
+        {
+            t.join();
+            throw std::system_error(rst.first, std::system_category(), rst.second.c_str());
+        }
+        return t;
+    }
+
+    /**
+    * Apply the attributes to the calling thread.
+    *
+    * @param attributes The thread attributes.
+    * @return Empty if all the attributes are applied, the error otherwise (errno is set too).
+    */
+    static std::string Apply(const ThreadAttributes &attributes)
+    {
+        if (!attributes._cpus.empty())
+        {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (auto cpu : attributes._cpus)
+            {
+                CPU_SET(cpu, &cpu_set);
+            }
+            // Migrates the thread straight away if it is on another CPU.
+            if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == -1)
+            {
+                return Error("Failed to set thread affinity: ");
+            }
+
+            if (attributes._numa_policy != ThreadAttributes::NumaPolicy::none)
+            {
+                unsigned cpu = 0;
+                unsigned node = 0;
+                if (syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+                {
+                    return Error("Failed to get NUMA node: ");
+                }
+
+                unsigned long node_mask[16]{};
+                node_mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+                auto mode = attributes._numa_policy == ThreadAttributes::NumaPolicy::bind_local ? MPOL_BIND : MPOL_PREFERRED;
+                if (syscall(SYS_set_mempolicy, mode, node_mask, 8 * sizeof(node_mask) + 1) == -1)
+                {
+                    return Error("Failed to set NUMA memory policy: ");
+                }
+            }
+        }
+
+        if (!attributes._name.empty())
+        {
+            // pthread_setname_np() fails on names longer than 15 chars.
+            auto name = attributes._name.substr(0, 15);
+            auto rst = pthread_setname_np(pthread_self(), name.c_str());
+            if (rst != 0)
+            {
+                errno = rst;
+                return Error("Failed to set thread name: ");
+            }
+        }
+
+        if (attributes._fifo_priority > 0)
+        {
+            struct sched_param param;
+            param.sched_priority = attributes._fifo_priority;
+            auto rst = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (rst != 0)
+            {
+                errno = rst;
+                return Error("Failed to set SCHED_FIFO: ");
+            }
+        }
+        return std::string();
+    }
+
+private:
+    static std::string Error(const char *what)
+    {
+        return std::string(what).append(strerror(errno));
+    }
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_THREADFACTORY_HXX_
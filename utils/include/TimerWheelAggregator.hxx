@@ -0,0 +1,369 @@
+#ifndef LEOPARD_UTILS_TIMERWHEELAGGREGATOR_HXX_
+#define LEOPARD_UTILS_TIMERWHEELAGGREGATOR_HXX_
+
+#include "Delegate.hxx"
+#include "NonCopyable.hxx"
+
+#include <time.h>
+#include <algorithm>
+#include <cstdint>
+
+namespace leopard { namespace utils {
+
+class TimerWheelAggregator;
+
+//
+// - Intrusive timer owned by the user, scheduling it never allocates.
+// - A node can be scheduled on one wheel at a time, destroying a scheduled node cancels it.
+//
+class TimerNode : private NonCopyable
+{
+public:
+    using Callback = Delegate<void()>;
+
+    TimerNode() = default;
+
+    explicit TimerNode(Callback callback) : _callback(std::move(callback))
+    {
+    }
+
+    ~TimerNode();
+
+    void SetCallback(Callback callback)
+    {
+        _callback = std::move(callback);
+    }
+
+    bool IsScheduled() const
+    {
+        return _next != this;
+    }
+
+private:
+    friend class TimerWheelAggregator;
+
+    void Unlink()
+    {
+        _prev->_next = _next;
+        _next->_prev = _prev;
+        _prev = _next = this;
+    }
+
+    void LinkBefore(TimerNode *node)
+    {
+        _prev = node->_prev;
+        _next = node;
+        node->_prev->_next = this;
+        node->_prev = this;
+    }
+
+    TimerNode *_prev{this};
+    TimerNode *_next{this};
+    TimerWheelAggregator *_wheel{nullptr};
+    uint64_t _expiry{0}; // In ticks
+    uint32_t _level{0};
+    Callback _callback;
+};
+
+//
+// - Hierarchical timing wheel aggregator for Reactor, O(1) schedule/cancel of TimerNode.
+// - Time is read from CLOCK_MONOTONIC (vDSO, no syscall) on each CollectEvents() pass, no kernel timer is used.
+// - LEVELS wheels of SLOTS slots each, a level covers SLOTS times the range of the level below. Timers further
+//   than the top level's range are parked in it and re-cascaded until due.
+// - NOT thread safe, schedule/cancel from the reactor thread (e.g. from other callbacks).
+//
+class TimerWheelAggregator
+{
+public:
+    // Reactor already derives from NonCopyable, so delete the copy operations here rather than derive from it again.
+    TimerWheelAggregator(const TimerWheelAggregator&) = delete;
+    TimerWheelAggregator& operator = (const TimerWheelAggregator&) = delete;
+
+    static constexpr uint32_t LEVELS{4};
+    static constexpr uint32_t SLOT_BITS{8};
+    static constexpr uint32_t SLOTS{1 << SLOT_BITS};
+    static constexpr uint64_t DEFAULT_TICK_NS{1000};
+
+    /**
+    * @param tick_ns Granularity of the wheel. Timers fire on the first pass at or after their tick.
+    */
+    explicit TimerWheelAggregator(uint64_t tick_ns = DEFAULT_TICK_NS) : _tick_ns(tick_ns ? tick_ns : 1)
+    {
+        _current = Now() / _tick_ns;
+    }
+
+    ~TimerWheelAggregator()
+    {
+        // Leave the timers still scheduled in a valid, unscheduled state.
+        for (auto &wheel : _wheels)
+        {
+            for (auto &slot : wheel)
+            {
+                while (slot.IsScheduled())
+                {
+                    slot._next->Unlink();
+                }
+            }
+        }
+    }
+
+    /**
+    * Get current CLOCK_MONOTONIC time, the time base of the wheel.
+    *
+    * @return Current time in nano-seconds.
+    */
+    static uint64_t Now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /**
+    * Schedule a timer to fire after a delay, a timer already scheduled is re-scheduled.
+    *
+    * @param node The timer.
+    * @param delay_ns Delay in nano-seconds from now.
+    */
+    void Schedule(TimerNode &node, uint64_t delay_ns)
+    {
+        ScheduleAt(node, Now() + delay_ns);
+    }
+
+    /**
+    * Schedule a timer to fire at a deadline, a timer already scheduled is re-scheduled.
+    *
+    * @param node The timer.
+    * @param deadline_ns Deadline in CLOCK_MONOTONIC nano-seconds.
+    */
+    void ScheduleAt(TimerNode &node, uint64_t deadline_ns)
+    {
+        if (node.IsScheduled())
+        {
+            node._wheel->Cancel(node);
+        }
+        // Round up so that a timer never fires before its deadline.
+        node._expiry = (deadline_ns + _tick_ns - 1) / _tick_ns;
+        node._wheel = this;
+        Insert(&node, _current + 1);
+        ++_size;
+    }
+
+    /**
+    * Cancel a timer.
+    *
+    * @param node The timer.
+    * @return True if the timer was scheduled, false otherwise.
+    */
+    bool Cancel(TimerNode &node)
+    {
+        if (!node.IsScheduled())
+        {
+            return false;
+        }
+        node.Unlink();
+        --_level_size[node._level];
+        --_size;
+        return true;
+    }
+
+    /**
+    * Get the number of scheduled timers.
+    *
+    * @return Number of scheduled timers.
+    */
+    std::size_t GetTimerNumber()
+    {
+        return _size;
+    }
+
+    /**
+    * Get how long the reactor may block without missing a timer, used by Reactor.
+    *
+    * @return Nano-seconds until the next timer may fire (or a cascade is due), UINT64_MAX if there's no timer.
+    */
+    uint64_t GetIdleTimeout()
+    {
+        // The first non-empty slot of each level is where its next timer fires or cascades, take the earliest.
+        uint64_t next = UINT64_MAX;
+        for (uint32_t level = 0; level < LEVELS; ++level)
+        {
+            if (_level_size[level] == 0)
+            {
+                continue;
+            }
+            auto index = (_current >> (SLOT_BITS * level)) + 1;
+            for (uint32_t i = 0; i < SLOTS; ++i, ++index)
+            {
+                if (_wheels[level][index & (SLOTS - 1)].IsScheduled())
+                {
+                    next = std::min(next, index << (SLOT_BITS * level));
+                    break;
+                }
+            }
+        }
+        if (next == UINT64_MAX)
+        {
+            return UINT64_MAX;
+        }
+
+        auto now = Now();
+        auto deadline = next * _tick_ns;
+        return deadline > now ? deadline - now : 0;
+    }
+
+protected:
+    std::size_t CollectEvents()
+    {
+        return Advance(Now());
+    }
+
+    /**
+    * Fire all the timers due at or before a time.
+    *
+    * @param now_ns Current time in CLOCK_MONOTONIC nano-seconds.
+    * @return Number of timers fired.
+    */
+    std::size_t Advance(uint64_t now_ns)
+    {
+        std::size_t number = 0;
+        auto now = now_ns / _tick_ns;
+        while (_current < now)
+        {
+            // If the lowest non-empty level is L, nothing can fire or cascade before the next wrap
+            // of level L-1, jump to right before it.
+            uint32_t level = 0;
+            while ((level < LEVELS) && (_level_size[level] == 0))
+            {
+                ++level;
+            }
+            if (level == LEVELS)
+            {
+                _current = now;
+                break;
+            }
+            if (level > 0)
+            {
+                auto boundary = _current | ((1ULL << (SLOT_BITS * level)) - 1);
+                if (boundary >= now)
+                {
+                    _current = now;
+                    break;
+                }
+                _current = boundary;
+            }
+            number += Tick();
+        }
+        return number;
+    }
+
+private:
+    std::size_t Tick()
+    {
+        ++_current;
+        for (uint32_t level = 1; level < LEVELS; ++level)
+        {
+            if (_current & ((1ULL << (SLOT_BITS * level)) - 1))
+            {
+                break;
+            }
+            Cascade(level, (_current >> (SLOT_BITS * level)) & (SLOTS - 1));
+        }
+
+        std::size_t number = 0;
+        auto &slot = _wheels[0][_current & (SLOTS - 1)];
+        if (!slot.IsScheduled())
+        {
+            return number;
+        }
+
+        // Detach the slot first, callbacks may schedule/cancel any timer including the ones in it.
+        TimerNode due;
+        Splice(slot, due);
+        while (due.IsScheduled())
+        {
+            auto *node = due._next;
+            node->Unlink();
+            --_level_size[0];
+            --_size;
+            ++number;
+            if (node->_callback)
+            {
+                node->_callback();
+            }
+        }
+        return number;
+    }
+
+    void Cascade(uint32_t level, uint64_t index)
+    {
+        auto &slot = _wheels[level][index];
+        if (!slot.IsScheduled())
+        {
+            return;
+        }
+
+        TimerNode pending;
+        Splice(slot, pending);
+        while (pending.IsScheduled())
+        {
+            auto *node = pending._next;
+            node->Unlink();
+            --_level_size[level];
+            // The current slot fires right after the cascades, so a timer due now can go into it.
+            Insert(node, _current);
+        }
+    }
+
+    // Timers due before the earliest tick given go into its slot.
+    void Insert(TimerNode *node, uint64_t earliest)
+    {
+        auto expiry = std::max(node->_expiry, earliest);
+        auto delta = expiry - _current;
+
+        uint32_t level = 0;
+        while ((level < LEVELS - 1) && (delta >> (SLOT_BITS * (level + 1))))
+        {
+            ++level;
+        }
+        if (delta >> (SLOT_BITS * LEVELS))
+        {
+            // Beyond the range of the wheel, park it in the top level slot cascaded last.
+            expiry = _current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+        }
+
+        node->_level = level;
+        node->LinkBefore(&_wheels[level][(expiry >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+        ++_level_size[level];
+    }
+
+    // Move all the nodes of a non-empty list to an empty one.
+    static void Splice(TimerNode &from, TimerNode &to)
+    {
+        to._next = from._next;
+        to._prev = from._prev;
+        to._next->_prev = &to;
+        to._prev->_next = &to;
+        from._prev = from._next = &from;
+    }
+
+    uint64_t _tick_ns{DEFAULT_TICK_NS};
+    uint64_t _current{0}; // In ticks
+    std::size_t _size{0};
+    // Number of timers per level.
+    std::size_t _level_size[LEVELS]{};
+    // Each slot is the sentinel of a circular list of timers.
+    TimerNode _wheels[LEVELS][SLOTS];
+};
+
+inline TimerNode::~TimerNode()
+{
+    if (IsScheduled())
+    {
+        _wheel->Cancel(*this);
+    }
+}
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_TIMERWHEELAGGREGATOR_HXX_
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef LEOPARD_UTILS_TSC_HXX_
+#define LEOPARD_UTILS_TSC_HXX_
+
+#include "Common.hxx"
+
+#include <time.h>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace leopard { namespace utils {
+
+//
+// - Time stamp counter, the cheapest timestamp to take on the hot path (~20 cycles, no vDSO call).
+// - Assumes an invariant TSC (constant rate, synchronized across cores), as on any recent x86 server.
+// - Ticks are converted to nano-seconds with a rate calibrated against CLOCK_MONOTONIC. Where there's no TSC
+//   the ticks are CLOCK_MONOTONIC nano-seconds already.
+//
+class Tsc
+{
+public:
+    static ALWAYS_INLINE uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return MonotonicNs();
+#endif
+    }
+
+    /**
+    * Read the TSC after all the preceding instructions completed, to time a code block.
+    *
+    * @return The TSC ticks.
+    */
+    static ALWAYS_INLINE uint64_t NowSerialized()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned aux;
+        return __rdtscp(&aux);
+#else
+        return MonotonicNs();
+#endif
+    }
+
+    static uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /**
+    * Measure the TSC rate, by spinning for a while. Call it once, off the hot path.
+    *
+    * @param duration_ns How long to measure for, the longer the more precise.
+    * @return Nano-seconds per TSC tick.
+    */
+    static double Calibrate(uint64_t duration_ns = 10000000)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        auto start_ns = MonotonicNs();
+        auto start = Now();
+        uint64_t now_ns;
+        while ((now_ns = MonotonicNs()) - start_ns < duration_ns) {}
+        auto ticks = Now() - start;
+        return ticks ? static_cast<double>(now_ns - start_ns) / ticks : 1.0;
+#else
+        static_cast<void>(duration_ns);
+        return 1.0;
+#endif
+    }
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_TSC_HXX_
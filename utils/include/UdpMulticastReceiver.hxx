@@ -0,0 +1,499 @@
+#ifndef LEOPARD_UTILS_UDPMULTICASTRECEIVER_HXX_
+#define LEOPARD_UTILS_UDPMULTICASTRECEIVER_HXX_
+
+#include "Common.hxx"
+#include "Delegate.hxx"
+#include "FdAggregator.hxx"
+#include "FixedSizePool.hxx"
+#include "InlineVector.hxx"
+#include "Logger.hxx"
+#include "MPMCRingBuffer.hxx"
+#include "NonCopyable.hxx"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <system_error>
+
+namespace leopard { namespace utils {
+
+//
+// - Message of a MPMCRingBuffer fed by UdpMulticastReceiver. The datagram is in a FixedSizePool block the
+//   kernel wrote to directly, the consumer must Deallocate() it.
+//
+struct UdpMessage
+{
+    std::size_t _seq{0};
+    InlineVector<char*, 1> _data_pointers;
+    uint32_t _size{0};
+    uint32_t _channel{0};
+    uint64_t _sequence{0};
+    uint64_t _kernel_ns{0};
+};
+
+//
+// - Receives a UDP multicast feed for a FdAggregator/Reactor: add it with AddFd(receiver.GetFd(), EPOLLIN, &receiver).
+// - Each readiness event is drained with recvmmsg(), BATCH_SIZE datagrams per syscall, into buffers allocated
+//   once. Every datagram gets the kernel receive timestamp (SO_TIMESTAMPNS, CLOCK_REALTIME).
+// - An optional parser reads the channel and sequence number of a datagram, the receiver then tracks the
+//   sequence gaps of each channel and reports them to a gap callback (e.g. to request a retransmission).
+//   Late (duplicate or out of order) datagrams are counted and still delivered. Only delivered datagrams are
+//   tracked, so the ones dropped locally (see GetDropNumber()) are reported as a gap too.
+// - Datagrams are delivered either to a callback, with a view of the receive buffer valid during the call,
+//   or straight to a MPMCRingBuffer<UdpMessage>: the kernel then writes to FixedSizePool blocks which are
+//   handed to the ring-buffer without copy. A datagram is dropped if the ring-buffer is full.
+// - NOT thread safe, runs on the reactor thread.
+//
+class UdpMulticastReceiver : public FdEventHandler, private NonCopyable
+{
+public:
+    static constexpr uint32_t BATCH_SIZE{64};
+    static constexpr uint32_t MAX_BATCHES_PER_EVENT{16};
+    static constexpr uint32_t MAX_CHANNELS{256};
+    static constexpr std::size_t DEFAULT_BUFFER_SIZE{2048};
+
+    struct Packet
+    {
+        const char *_data{nullptr};
+        std::size_t _size{0};
+        uint64_t _kernel_ns{0};
+        uint32_t _channel{0};
+        uint64_t _sequence{0};
+    };
+
+    struct ChannelStats
+    {
+        bool _started{false};
+        uint64_t _next_sequence{0};
+        uint64_t _packet_count{0};
+        uint64_t _gap_count{0};
+        uint64_t _lost_count{0};
+        uint64_t _late_count{0};
+    };
+
+    using PacketCallback = Delegate<void(const Packet&)>;
+    // Fills the _channel and _sequence of a packet, returns false if it carries none.
+    using SequenceParser = Delegate<bool(Packet&)>;
+    // Called with the channel, the expected sequence number and the one received instead.
+    using GapCallback = Delegate<void(uint32_t, uint64_t, uint64_t)>;
+
+    /**
+    * Open a socket bound to the port and join a multicast group.
+    *
+    * @param group Multicast group address, e.g. "239.1.1.1".
+    * @param port UDP port, 0 to pick any (see GetPort()).
+    * @param interface_address Address of the local interface to join the group on, "0.0.0.0" to let the kernel pick.
+    * @param buffer_size Size of each receive buffer in callback mode, larger datagrams are dropped.
+    * @param receive_buffer_bytes SO_RCVBUF of the socket, 0 to keep the system default.
+    */
+    UdpMulticastReceiver(const std::string &group, uint16_t port, const std::string &interface_address = "0.0.0.0",
+                         std::size_t buffer_size = DEFAULT_BUFFER_SIZE, int receive_buffer_bytes = 0)
+        : FdEventHandler(OpenSocket(port, receive_buffer_bytes)),
+          _interface_address(interface_address),
+          _buffer_size(buffer_size),
+          _buffers(new char[BATCH_SIZE * buffer_size]),
+          _channels(new ChannelStats[MAX_CHANNELS])
+    {
+        if (!JoinGroup(group))
+        {
+            auto error = errno;
+            close(GetFd());
+            throw std::system_error(error, std::system_category(), std::string("Failed to join multicast group: ").append(group).c_str());
+        }
+
+        std::memset(_headers, 0, sizeof(_headers));
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            _iovecs[i].iov_base = _buffers.get() + i * _buffer_size;
+            _iovecs[i].iov_len = _buffer_size;
+            _headers[i].msg_hdr.msg_iov = &_iovecs[i];
+            _headers[i].msg_hdr.msg_iovlen = 1;
+            _headers[i].msg_hdr.msg_control = _controls[i];
+        }
+    }
+
+    ~UdpMulticastReceiver()
+    {
+        ReleaseBlocks();
+        RemoveFromAggregator();
+        close(GetFd());
+    }
+
+    /**
+    * Join one more multicast group on the same socket and port, e.g. another channel of the feed.
+    *
+    * @param group Multicast group address.
+    * @return True if the group is joined successfully, false otherwise.
+    */
+    bool JoinGroup(const std::string &group)
+    {
+        struct ip_mreq request;
+        std::memset(&request, 0, sizeof(request));
+        if ((inet_pton(AF_INET, group.c_str(), &request.imr_multiaddr) != 1)
+            || (inet_pton(AF_INET, _interface_address.c_str(), &request.imr_interface) != 1))
+        {
+            errno = EINVAL;
+            LEOPARD_LOG_ERROR("Invalid multicast address: group={}, interface={}", group, _interface_address);
+            return false;
+        }
+        if (setsockopt(GetFd(), IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == -1)
+        {
+            LEOPARD_LOG_ERROR("Failed to join multicast group: group={}, interface={}, errno={}, err_text={}",
+                              group, _interface_address, errno, strerror(errno));
+            return false;
+        }
+        LEOPARD_LOG_INFO("Joined multicast group: fd={}, group={}, interface={}", GetFd(), group, _interface_address);
+        return true;
+    }
+
+    /**
+    * Deliver the datagrams to a callback.
+    *
+    * @param callback Called with each datagram, the data is only valid during the call.
+    */
+    void SetPacketCallback(PacketCallback callback)
+    {
+        ReleaseBlocks();
+        _ring = nullptr;
+        _pool = nullptr;
+        _callback = std::move(callback);
+    }
+
+    /**
+    * Deliver the datagrams to a ring-buffer, in blocks of a pool that the consumers must deallocate.
+    *
+    * @param ring The ring-buffer, this receiver is its only producer.
+    * @param pool The pool, its block size is the max datagram size. It must outlive the receiver.
+    */
+    void SetRingBuffer(MPMCRingBuffer<UdpMessage> *ring, FixedSizePool *pool)
+    {
+        ReleaseBlocks();
+        _callback.Reset();
+        _ring = ring;
+        _pool = pool;
+    }
+
+    void SetSequenceParser(SequenceParser parser)
+    {
+        _parser = std::move(parser);
+    }
+
+    void SetGapCallback(GapCallback callback)
+    {
+        _on_gap = std::move(callback);
+    }
+
+    /**
+    * Get the local port, useful when bound to port 0.
+    *
+    * @return The port, 0 on error.
+    */
+    uint16_t GetPort()
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(GetFd(), reinterpret_cast<struct sockaddr*>(&addr), &len) == -1)
+        {
+            return 0;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    /**
+    * Get the sequence tracking of a channel.
+    *
+    * @param channel The channel, less than MAX_CHANNELS.
+    * @return The stats of the channel.
+    */
+    const ChannelStats& GetChannelStats(uint32_t channel) const
+    {
+        return _channels[channel < MAX_CHANNELS ? channel : 0];
+    }
+
+    uint64_t GetPacketNumber() const
+    {
+        return _packet_count;
+    }
+
+    uint64_t GetSyscallNumber() const
+    {
+        return _syscall_count;
+    }
+
+    /**
+    * Get the number of datagrams received but not delivered: truncated, or the ring-buffer was full.
+    *
+    * @return Number of datagrams dropped.
+    */
+    uint64_t GetDropNumber() const
+    {
+        return _drop_count;
+    }
+
+    HandlerFunc GetHandlerFunc() override
+    {
+        return [this](){ OnReadable(); };
+    }
+
+    ErrorFunc GetErrorFunc() override
+    {
+        return [this](){ LEOPARD_LOG_ERROR("Multicast socket error: fd={}", GetFd()); };
+    }
+
+    /**
+    * Drain the socket, called by the aggregator when it's readable.
+    */
+    void OnReadable()
+    {
+        for (uint32_t i = 0; i < MAX_BATCHES_PER_EVENT; ++i)
+        {
+            if (!ReceiveBatch())
+            {
+                break;
+            }
+        }
+    }
+
+private:
+    static int OpenSocket(uint16_t port, int receive_buffer_bytes)
+    {
+        auto fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(), std::string("Failed to create multicast socket: ").append(strerror(errno)).c_str());
+        }
+
+        int on = 1;
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
+            || (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+            || (receive_buffer_bytes && (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes, sizeof(receive_buffer_bytes)) == -1))
+            || (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1))
+        {
+            auto error = errno;
+            close(fd);
+            throw std::system_error(error, std::system_category(), std::string("Failed to set up multicast socket: ").append(strerror(error)).c_str());
+        }
+        return fd;
+    }
+
+    // Returns true if the batch was full, i.e. more datagrams may be pending.
+    bool ReceiveBatch()
+    {
+        auto number = PrepareBuffers();
+        if (number == 0)
+        {
+            // No free pool block, leave the datagrams in the socket buffer until the consumers release some.
+            return false;
+        }
+
+        int received = recvmmsg(GetFd(), _headers, number, MSG_DONTWAIT, nullptr);
+        ++_syscall_count;
+        if (received <= 0)
+        {
+            if ((received == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                LEOPARD_LOG_ERROR("Failed to receive from multicast socket: fd={}, errno={}, err_text={}", GetFd(), errno, strerror(errno));
+            }
+            return false;
+        }
+
+        auto count = static_cast<uint32_t>(received);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto &packet = _packets[i];
+            packet = Packet();
+            packet._data = static_cast<const char*>(_iovecs[i].iov_base);
+            packet._size = _headers[i].msg_len;
+            packet._kernel_ns = GetTimestamp(_headers[i].msg_hdr);
+            _parsed[i] = _parser && _parser(packet);
+        }
+        _packet_count += count;
+
+        if (_ring)
+        {
+            Enqueue(count);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (UNLIKELY(_headers[i].msg_hdr.msg_flags & MSG_TRUNC))
+                {
+                    ++_drop_count;
+                    continue;
+                }
+                if (_parsed[i])
+                {
+                    Track(_packets[i]);
+                }
+                if (_callback)
+                {
+                    _callback(_packets[i]);
+                }
+            }
+        }
+        return count == number;
+    }
+
+    // Returns the number of buffers available, recvmmsg() overwrites the lengths of the headers.
+    uint32_t PrepareBuffers()
+    {
+        uint32_t number = BATCH_SIZE;
+        if (_ring)
+        {
+            for (number = 0; number < BATCH_SIZE; ++number)
+            {
+                if (!_blocks[number] && !(_blocks[number] = static_cast<char*>(_pool->Allocate())))
+                {
+                    break;
+                }
+                _iovecs[number].iov_base = _blocks[number];
+                _iovecs[number].iov_len = _pool->GetBlockSize();
+            }
+        }
+        for (uint32_t i = 0; i < number; ++i)
+        {
+            _headers[i].msg_hdr.msg_controllen = sizeof(_controls[i]);
+            _headers[i].msg_hdr.msg_flags = 0;
+        }
+        return number;
+    }
+
+    void Enqueue(uint32_t count)
+    {
+        // Reserve only for the complete datagrams, a committed batch publishes all its messages.
+        uint32_t complete = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            complete += !(_headers[i].msg_hdr.msg_flags & MSG_TRUNC);
+        }
+        auto batch = _ring->GetMessagesForWrite(complete);
+        uint32_t delivered = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (UNLIKELY((_headers[i].msg_hdr.msg_flags & MSG_TRUNC) || (delivered == batch.GetSize())))
+            {
+                // The block is kept for the next batch.
+                ++_drop_count;
+                continue;
+            }
+            if (_parsed[i])
+            {
+                Track(_packets[i]);
+            }
+            auto &msg = batch[delivered++];
+            msg._data_pointers.push_back(_blocks[i]);
+            msg._size = static_cast<uint32_t>(_packets[i]._size);
+            msg._channel = _packets[i]._channel;
+            msg._sequence = _packets[i]._sequence;
+            msg._kernel_ns = _packets[i]._kernel_ns;
+            _blocks[i] = nullptr;
+        }
+        if (!batch.IsEmpty())
+        {
+            _ring->CommitMessagesWrite(batch);
+        }
+    }
+
+    void Track(const Packet &packet)
+    {
+        if (UNLIKELY(packet._channel >= MAX_CHANNELS))
+        {
+            return;
+        }
+        auto &channel = _channels[packet._channel];
+        ++channel._packet_count;
+        if (UNLIKELY(!channel._started))
+        {
+            channel._started = true;
+            channel._next_sequence = packet._sequence + 1;
+            return;
+        }
+
+        if (LIKELY(packet._sequence == channel._next_sequence))
+        {
+            ++channel._next_sequence;
+        }
+        else if (packet._sequence > channel._next_sequence)
+        {
+            ++channel._gap_count;
+            channel._lost_count += packet._sequence - channel._next_sequence;
+            auto expected = channel._next_sequence;
+            channel._next_sequence = packet._sequence + 1;
+            if (_on_gap)
+            {
+                _on_gap(packet._channel, expected, packet._sequence);
+            }
+        }
+        else
+        {
+            ++channel._late_count;
+        }
+    }
+
+    static uint64_t GetTimestamp(struct msghdr &header)
+    {
+        for (auto *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+            {
+                struct timespec ts;
+                std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+            }
+        }
+        return 0;
+    }
+
+    void ReleaseBlocks()
+    {
+        for (uint32_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            if (_blocks[i])
+            {
+                _pool->Deallocate(_blocks[i]);
+                _blocks[i] = nullptr;
+            }
+            _iovecs[i].iov_base = _buffers.get() + i * _buffer_size;
+            _iovecs[i].iov_len = _buffer_size;
+        }
+    }
+
+    std::string _interface_address;
+    std::size_t _buffer_size;
+    std::unique_ptr<char[]> _buffers;
+    std::unique_ptr<ChannelStats[]> _channels;
+
+    struct mmsghdr _headers[BATCH_SIZE];
+    struct iovec _iovecs[BATCH_SIZE];
+    alignas(struct cmsghdr) char _controls[BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+    Packet _packets[BATCH_SIZE];
+    bool _parsed[BATCH_SIZE]{};
+
+    PacketCallback _callback;
+    SequenceParser _parser;
+    GapCallback _on_gap;
+
+    MPMCRingBuffer<UdpMessage> *_ring{nullptr};
+    FixedSizePool *_pool{nullptr};
+    char *_blocks[BATCH_SIZE]{};
+
+    uint64_t _packet_count{0};
+    uint64_t _syscall_count{0};
+    uint64_t _drop_count{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_UDPMULTICASTRECEIVER_HXX_
@@ -0,0 +1,320 @@
+#ifndef LEOPARD_UTILS_WORKSTEALINGEXECUTOR_HXX_
+#define LEOPARD_UTILS_WORKSTEALINGEXECUTOR_HXX_
+
+#include "Common.hxx"
+#include "NonCopyable.hxx"
+#include "ThreadFactory.hxx"
+#include "ThreadRAII.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace leopard { namespace utils {
+
+//
+// - Thread pool for non-critical batch work (e.g. end-of-day recomputations), its workers are created by
+//   ThreadFactory so that they can be kept off the cores of the pinned reactors.
+// - Each worker has a lock-free deque (Chase-Lev): tasks submitted from a worker go to its own deque, it pops
+//   them LIFO while idle workers steal FIFO from the others. Tasks submitted from other threads go to a shared
+//   queue first. A full worker deque overflows to the shared queue too.
+// - Idle workers sleep on a condition variable, it's not meant for latency-critical work.
+//
+class WorkStealingExecutor : private NonCopyable
+{
+public:
+    using Task = std::function<void()>;
+
+    static constexpr std::size_t DEQUE_CAPACITY{4096};
+
+    /**
+    * @param worker_number Number of worker threads.
+    * @param attributes Attributes of the workers, their name is suffixed with the worker index.
+    */
+    explicit WorkStealingExecutor(std::size_t worker_number, const ThreadAttributes &attributes = ThreadAttributes())
+    {
+        worker_number = worker_number ? worker_number : 1;
+        for (std::size_t i = 0; i < worker_number; ++i)
+        {
+            _workers.emplace_back(new Worker());
+        }
+
+        try
+        {
+            for (std::size_t i = 0; i < worker_number; ++i)
+            {
+                auto worker_attributes = attributes;
+                if (!worker_attributes._name.empty())
+                {
+                    worker_attributes._name.append(std::to_string(i));
+                }
+                _threads.emplace_back(ThreadFactory::Create(worker_attributes, &WorkStealingExecutor::Run, this, i), ThreadRAII::DtorAction::join);
+            }
+        }
+        catch (...)
+        {
+            Shutdown();
+            throw;
+        }
+    }
+
+    // Runs all the tasks submitted before returning.
+    ~WorkStealingExecutor()
+    {
+        Wait();
+        Shutdown();
+    }
+
+    /**
+    * Submit a task, from any thread including the workers.
+    *
+    * @param task The task.
+    */
+    void Submit(Task task)
+    {
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        auto *t = new Task(std::move(task));
+        if ((_current._executor == this) && _workers[_current._index]->_deque.Push(t))
+        {
+            if (_sleeper_number.load(std::memory_order_seq_cst) > 0)
+            {
+                _cv.notify_one();
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _shared.push_back(t);
+        }
+        _cv.notify_one();
+    }
+
+    /**
+    * Block until all the tasks submitted so far, and the tasks they submit, have run.
+    */
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle_cv.wait(lock, [this](){ return _pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    std::size_t GetWorkerNumber() const
+    {
+        return _workers.size();
+    }
+
+    /**
+    * Get the number of tasks run by a worker after stealing them from another one.
+    *
+    * @return Number of tasks stolen.
+    */
+    uint64_t GetStealNumber() const
+    {
+        return _steal_count.load(std::memory_order_relaxed);
+    }
+
+private:
+    //
+    // Chase-Lev work-stealing deque with a fixed capacity (Le et al., "Correct and Efficient Work-Stealing for
+    // Weak Memory Models"). Push()/Take() from the owner worker only, Steal() from any thread.
+    //
+    class Deque
+    {
+    public:
+        bool Push(Task *task)
+        {
+            auto b = _bottom.load(std::memory_order_relaxed);
+            auto t = _top.load(std::memory_order_acquire);
+            if (b - t >= static_cast<int64_t>(DEQUE_CAPACITY))
+            {
+                return false;
+            }
+            _tasks[b & (DEQUE_CAPACITY - 1)].store(task, std::memory_order_relaxed);
+            // Publishes the task slot to Steal(), which loads _bottom with acquire.
+            _bottom.store(b + 1, std::memory_order_release);
+            return true;
+        }
+
+        Task* Take()
+        {
+            auto b = _bottom.load(std::memory_order_relaxed) - 1;
+            _bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = _top.load(std::memory_order_relaxed);
+            if (t > b)
+            {
+                _bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            auto *task = _tasks[b & (DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // Last task, race against the thieves for it.
+                if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    task = nullptr;
+                }
+                _bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return task;
+        }
+
+        Task* Steal()
+        {
+            auto t = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = _bottom.load(std::memory_order_acquire);
+            if (t >= b)
+            {
+                return nullptr;
+            }
+
+            auto *task = _tasks[t & (DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return task;
+        }
+
+    private:
+        static_assert((DEQUE_CAPACITY & (DEQUE_CAPACITY - 1)) == 0, "DEQUE_CAPACITY must be a power of 2");
+
+        alignas(CACHE_LINE_SIZE) std::atomic<int64_t> _top{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<int64_t> _bottom{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<Task*> _tasks[DEQUE_CAPACITY]{};
+    };
+
+    struct Worker
+    {
+        Deque _deque;
+    };
+
+    struct Current
+    {
+        WorkStealingExecutor *_executor{nullptr};
+        std::size_t _index{0};
+    };
+
+    void Run(std::size_t index)
+    {
+        _current = Current{this, index};
+        std::minstd_rand random(static_cast<uint32_t>(index + 1));
+        auto &deque = _workers[index]->_deque;
+
+        while (true)
+        {
+            auto *task = deque.Take();
+            if (!task)
+            {
+                task = TakeShared();
+            }
+            if (!task)
+            {
+                task = StealFromOthers(index, random);
+            }
+            if (task)
+            {
+                Execute(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_stop)
+            {
+                break;
+            }
+            if (_shared.empty())
+            {
+                // Tasks pushed to a worker deque only notify sleepers, so also wake up once in a while to steal.
+                _sleeper_number.fetch_add(1, std::memory_order_seq_cst);
+                _cv.wait_for(lock, std::chrono::milliseconds(1));
+                _sleeper_number.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        _current = Current();
+    }
+
+    Task* TakeShared()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_shared.empty())
+        {
+            return nullptr;
+        }
+        auto *task = _shared.front();
+        _shared.pop_front();
+        return task;
+    }
+
+    Task* StealFromOthers(std::size_t index, std::minstd_rand &random)
+    {
+        auto number = _workers.size();
+        auto start = random() % number;
+        for (std::size_t i = 0; i < number; ++i)
+        {
+            auto victim = (start + i) % number;
+            if (victim == index)
+            {
+                continue;
+            }
+            if (auto *task = _workers[victim]->_deque.Steal())
+            {
+                _steal_count.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void Execute(Task *task)
+    {
+        std::unique_ptr<Task> guard(task);
+        (*task)();
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            // Lock so that Wait() can't miss the notification between its check and its wait.
+            std::lock_guard<std::mutex> lock(_mutex);
+            _idle_cv.notify_all();
+        }
+    }
+
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        // Joined by ThreadRAII.
+        _threads.clear();
+    }
+
+    static inline thread_local Current _current{nullptr, 0};
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<ThreadRAII> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _idle_cv;
+    std::deque<Task*> _shared;
+    bool _stop{false};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _pending{0};
+    std::atomic<uint32_t> _sleeper_number{0};
+    std::atomic<uint64_t> _steal_count{0};
+};
+
+}} // namespace utils::leopard
+
+#endif // LEOPARD_UTILS_WORKSTEALINGEXECUTOR_HXX_
@@ -3,15 +3,63 @@
 
 #include "Singleton.hxx"
 #include "Event.hxx"
+#include "LockFreeEvent.hxx"
 #include "ThreadRAII.hxx"
+#include "ThreadFactory.hxx"
+#include "WorkStealingExecutor.hxx"
 #include "MPMCRingBuffer.hxx"
+#include "MPMCSeqRingBuffer.hxx"
+#include "SPSCRingBuffer.hxx"
+#include "BroadcastRingBuffer.hxx"
 #include "Reactor.hxx"
+#include "IoUringAggregator.hxx"
+#include "TimerWheelAggregator.hxx"
+#include "QueueAggregator.hxx"
+#include "FixedSizePool.hxx"
+#include "InlineVector.hxx"
+#include "Logger.hxx"
+#include "Histogram.hxx"
+#include "ShmRingBuffer.hxx"
+#include "UdpMulticastReceiver.hxx"
 
+#include <algorithm>
+#include <array>
 #include <map>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <fstream>
+
+// Counts the calls to operator new per thread, so that a test can check its hot path doesn't allocate.
+// It replaces the global operator new/delete of the whole test binary.
+thread_local uint64_t tAllocationCtr{0};
+
+void* operator new(std::size_t size)
+{
+    ++tAllocationCtr;
+    if (void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
 
 TEST(Singleton, correctness)
 {
@@ -139,6 +187,124 @@ TEST(Event, correctness)
     event.Notify(a, b);
 }
 
+TEST(LockFreeEvent, disconnect_in_callback)
+{
+    leopard::utils::LockFreeEvent<void(int, int)> event;
+    int sum{0};
+    uint32_t onceKey{0};
+    auto key = event.Connect([&sum](int a, int b){ sum += a + b; });
+    onceKey = event.Connect([&](int a, int){ sum += a; event.Disconnect(onceKey); });
+    ASSERT_EQ(event.GetObserverNumber(), 2U);
+
+    event.Notify(1, 2);
+    ASSERT_EQ(sum, 4);
+    ASSERT_EQ(event.GetObserverNumber(), 1U);
+
+    // Connected from a callback, called from the next Notify() on.
+    uint32_t nestedKey{UINT32_MAX};
+    auto connectKey = event.Connect([&](int, int){ if (nestedKey == UINT32_MAX) { nestedKey = event.Connect([&sum](int, int){ sum += 100; }); } });
+    event.Notify(1, 1);
+    ASSERT_EQ(sum, 6);
+    event.Notify(1, 1);
+    ASSERT_EQ(sum, 108);
+
+    ASSERT_TRUE(event.Disconnect(key));
+    ASSERT_TRUE(event.Disconnect(connectKey));
+    ASSERT_TRUE(event.Disconnect(nestedKey));
+    ASSERT_FALSE(event.Disconnect(nestedKey));
+    event.Notify(1, 1);
+    ASSERT_EQ(sum, 108);
+    ASSERT_EQ(event.GetObserverNumber(), 0U);
+}
+
+TEST(LockFreeEvent, concurrent_notify_connect_disconnect)
+{
+    leopard::utils::LockFreeEvent<void(uint64_t)> event;
+    std::atomic<uint64_t> stableSum{0};
+    std::atomic<uint64_t> churnCalls{0};
+    event.Connect([&stableSum](uint64_t v){ stableSum.fetch_add(v, std::memory_order_relaxed); });
+
+    uint32_t notifierNum{3};
+    uint64_t numNotify{200000};
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> notifierThreads;
+    for (uint32_t n = 0; n < notifierNum; ++n)
+    {
+        notifierThreads.emplace_back([&](){
+            for (uint64_t i = 1; i <= numNotify; ++i)
+            {
+                event.Notify(i);
+            }
+        });
+    }
+
+    // Keep replacing the observer vector while it is being read.
+    uint64_t numChurn{0};
+    auto churn = std::thread([&](){
+        while (!done.load())
+        {
+            auto key = event.Connect([&churnCalls](uint64_t){ churnCalls.fetch_add(1, std::memory_order_relaxed); });
+            ASSERT_TRUE(event.Disconnect(key));
+            ++numChurn;
+        }
+    });
+
+    for (auto &nt : notifierThreads)
+    {
+        nt.join();
+    }
+    done = true;
+    churn.join();
+
+    // Every Notify() reached the observer connected all along.
+    ASSERT_EQ(stableSum.load(), notifierNum * numNotify * (numNotify + 1) / 2);
+    ASSERT_EQ(event.GetObserverNumber(), 1U);
+    std::cout << "Observer vectors replaced: " << 2 * numChurn << ", churned observer calls: " << churnCalls.load() << std::endl;
+}
+
+TEST(LockFreeEvent, disconnect_in_callback_while_other_thread_connects)
+{
+    leopard::utils::LockFreeEvent<void()> event;
+    uint64_t numLoop{20000};
+    std::atomic<uint64_t> notifyCtr{0};
+    std::atomic<uint32_t> finished{0};
+
+    // A callback connecting/disconnecting while another thread waits for this Notify() to finish.
+    event.Connect([&](){
+        event.Disconnect(event.Connect([](){}));
+        ++notifyCtr;
+    });
+
+    auto notifier = std::thread([&](){
+        for (uint64_t i = 0; i < numLoop; ++i)
+        {
+            event.Notify();
+        }
+        ++finished;
+    });
+    auto churn = std::thread([&](){
+        for (uint64_t i = 0; i < numLoop; ++i)
+        {
+            event.Disconnect(event.Connect([](){}));
+        }
+        ++finished;
+    });
+
+    // A deadlock leaves the threads joinable, failing here terminates the test instead of hanging it.
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while ((finished.load() < 2) && (std::chrono::steady_clock::now() < until))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(finished.load(), 2U);
+    notifier.join();
+    churn.join();
+
+    ASSERT_EQ(notifyCtr.load(), numLoop);
+    ASSERT_EQ(event.GetObserverNumber(), 1U);
+}
+
 bool Filter(int n)
 {
     bool good = (n > 10);
@@ -187,6 +353,92 @@ TEST(ThreadRAII, correctness)
     std::cout << "Cond => unsatisfied" << std::endl;
 }
 
+TEST(ThreadFactory, attributes_applied_before_user_function)
+{
+    leopard::utils::ThreadAttributes attributes;
+    attributes._cpus = {0};
+    attributes._numa_policy = leopard::utils::ThreadAttributes::NumaPolicy::prefer_local;
+    attributes._name = "leopard-reactor-0";
+
+    int cpu{-1};
+    long policy{-1};
+    char name[16]{};
+    {
+        leopard::utils::ThreadRAII t(leopard::utils::ThreadFactory::Create(attributes, [&](){
+            cpu = sched_getcpu();
+            int mode{-1};
+            unsigned long nodeMask[16]{};
+            policy = syscall(SYS_get_mempolicy, &mode, nodeMask, 8 * sizeof(nodeMask) + 1, nullptr, 0) == 0 ? mode : -1;
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+        }), leopard::utils::ThreadRAII::DtorAction::join);
+    }
+    ASSERT_EQ(cpu, 0);
+    ASSERT_EQ(policy, MPOL_PREFERRED);
+    ASSERT_STREQ(name, "leopard-reactor");
+
+    // The user function never runs if the thread can't be set up.
+    attributes._cpus = {CPU_SETSIZE - 1};
+    bool run{false};
+    ASSERT_THROW(leopard::utils::ThreadFactory::Create(attributes, [&run](){ run = true; }), std::system_error);
+    ASSERT_FALSE(run);
+
+    attributes._cpus.clear();
+    attributes._fifo_priority = 1;
+    int scheduler{-1};
+    try
+    {
+        leopard::utils::ThreadFactory::Create(attributes, [&scheduler](){ scheduler = sched_getscheduler(0); }).join();
+    }
+    catch (const std::system_error &e)
+    {
+        ASSERT_EQ(e.code().value(), EPERM);
+        GTEST_SKIP() << "No permission for SCHED_FIFO";
+    }
+    ASSERT_EQ(scheduler, SCHED_FIFO);
+}
+
+// Sum [begin, end) by splitting the range into tasks submitted from the workers.
+void SumRange(leopard::utils::WorkStealingExecutor &executor, std::atomic<uint64_t> &sum, uint64_t begin, uint64_t end)
+{
+    if (end - begin <= 64)
+    {
+        uint64_t local{0};
+        for (auto i = begin; i < end; ++i)
+        {
+            local += i;
+        }
+        sum += local;
+        return;
+    }
+    auto mid = begin + (end - begin) / 2;
+    executor.Submit([&executor, &sum, begin, mid](){ SumRange(executor, sum, begin, mid); });
+    executor.Submit([&executor, &sum, mid, end](){ SumRange(executor, sum, mid, end); });
+}
+
+TEST(WorkStealingExecutor, nested_tasks)
+{
+    leopard::utils::ThreadAttributes attributes;
+    attributes._name = "batch";
+    leopard::utils::WorkStealingExecutor executor(4, attributes);
+    ASSERT_EQ(executor.GetWorkerNumber(), 4U);
+
+    std::atomic<uint64_t> sum{0};
+    uint64_t n{1000000};
+    executor.Submit([&](){ SumRange(executor, sum, 0, n); });
+    executor.Wait();
+    ASSERT_EQ(sum.load(), n * (n - 1) / 2);
+
+    // Many tasks from outside the workers.
+    std::atomic<uint32_t> ctr{0};
+    for (uint32_t i = 0; i < 10000; ++i)
+    {
+        executor.Submit([&ctr](){ ++ctr; });
+    }
+    executor.Wait();
+    ASSERT_EQ(ctr.load(), 10000U);
+    std::cout << "Tasks stolen: " << executor.GetStealNumber() << std::endl;
+}
+
 TEST(MPMCRingBuffer, basic_equeue_dequeue)
 {
     struct Message
@@ -241,15 +493,16 @@ TEST(MPMCRingBuffer, basic_equeue_dequeue)
     }
 }
 
-TEST(MPMCRingBuffer, multiple_producer_multiple_consumer)
+struct RingBufferMessage
 {
-    struct Message
-    {
-        std::size_t _seq{0};
-        std::vector<const char*> _data_pointers;
-    };
+    std::size_t _seq{0};
+    std::vector<const char*> _data_pointers;
+};
 
-    leopard::utils::MPMCRingBuffer<Message> buff;
+template <typename RingBuffer>
+void MultipleProducerMultipleConsumer()
+{
+    RingBuffer buff;
     std::size_t capacity = 13;
     std::size_t realCapacity = 16;
     ASSERT_TRUE(buff.Init(capacity));
@@ -347,73 +600,2094 @@ TEST(MPMCRingBuffer, multiple_producer_multiple_consumer)
     ASSERT_EQ(readFailureCtr.load(), 0U);
 }
 
-TEST(MPMCRingBuffer, timerfd_eventfd_socket)
+TEST(MPMCRingBuffer, multiple_producer_multiple_consumer)
 {
-    class TimerFdHandler : public leopard::utils::FdEventHandler
+    MultipleProducerMultipleConsumer<leopard::utils::MPMCRingBuffer<RingBufferMessage>>();
+}
+
+TEST(MPMCRingBuffer, batch_equeue_dequeue)
+{
+    leopard::utils::MPMCRingBuffer<RingBufferMessage> buff;
+    std::size_t realCapacity = 16;
+    ASSERT_TRUE(buff.Init(realCapacity));
+
+    // Move the counters close to the end of the buffer so that the next batches wrap around.
+    for (std::size_t i = 0; i < realCapacity - 3; ++i)
     {
-    public:
-        using leopard::utils::FdEventHandler::FdEventHandler;
+        buff.CommitMessageWrite(buff.GetMessageForWrite());
+        buff.CommitMessageRead(buff.GetMessageForRead());
+    }
 
-        void OnEvent()
-        {
-            uint64_t res;
-            if (read(GetFd(), &res, sizeof(res)) == sizeof(res))
+    auto writeBatch = buff.GetMessagesForWrite(10);
+    ASSERT_EQ(writeBatch.GetSize(), 10U);
+    ASSERT_EQ(writeBatch.GetSeq(), realCapacity - 3);
+    for (std::size_t i = 0; i < writeBatch.GetSize(); ++i)
+    {
+        ASSERT_EQ(writeBatch[i]._seq, realCapacity - 3 + i);
+        ASSERT_EQ(&writeBatch[i] - &writeBatch[0], i < 3 ? static_cast<std::ptrdiff_t>(i) : static_cast<std::ptrdiff_t>(i) - 16);
+    }
+
+    // Only the remaining free slots can be reserved.
+    auto fullBatch = buff.GetMessagesForWrite(10);
+    ASSERT_EQ(fullBatch.GetSize(), realCapacity - 10);
+    ASSERT_TRUE(buff.GetMessagesForWrite(1).IsEmpty());
+    ASSERT_TRUE(buff.GetMessagesForRead().IsEmpty());
+
+    buff.CommitMessagesWrite(writeBatch);
+    buff.CommitMessagesWrite(fullBatch);
+    ASSERT_EQ(buff.GetMessageNumber(), realCapacity);
+
+    // Drain all in one call.
+    auto readBatch = buff.GetMessagesForRead();
+    ASSERT_EQ(readBatch.GetSize(), realCapacity);
+    for (std::size_t i = 0; i < readBatch.GetSize(); ++i)
+    {
+        ASSERT_EQ(readBatch[i]._seq, realCapacity - 3 + i);
+    }
+    ASSERT_TRUE(buff.GetMessagesForRead().IsEmpty());
+    buff.CommitMessagesRead(readBatch);
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+}
+
+TEST(MPMCRingBuffer, batch_throughput)
+{
+    std::size_t numValues{1 << 22};
+    std::size_t batchSize{32};
+
+    auto run = [&](bool batch) {
+        leopard::utils::MPMCRingBuffer<RingBufferMessage> buff;
+        buff.Init(1024);
+        std::atomic<std::size_t> readFailureCtr{0};
+        auto start = std::chrono::steady_clock::now();
+
+        std::thread consumer([&](){
+            std::size_t expected = 0;
+            while (expected < numValues)
             {
-                ++_evtCtr;
+                if (batch)
+                {
+                    auto msgs = buff.GetMessagesForRead();
+                    if (msgs.IsEmpty())
+                    {
+                        std::this_thread::yield();
+                    }
+                    for (std::size_t i = 0; i < msgs.GetSize(); ++i)
+                    {
+                        readFailureCtr += (msgs[i]._seq != expected++);
+                    }
+                    buff.CommitMessagesRead(msgs);
+                }
+                else if (auto msg = buff.GetMessageForRead())
+                {
+                    readFailureCtr += (msg->_seq != expected++);
+                    buff.CommitMessageRead(msg);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
             }
-        }
+        });
 
-        void OnError()
+        std::size_t written = 0;
+        while (written < numValues)
         {
-            _err = true;
-            close(GetFd());
+            if (batch)
+            {
+                auto msgs = buff.GetMessagesForWrite(std::min(batchSize, numValues - written));
+                if (msgs.IsEmpty())
+                {
+                    std::this_thread::yield();
+                }
+                written += msgs.GetSize();
+                buff.CommitMessagesWrite(msgs);
+            }
+            else if (auto msg = buff.GetMessageForWrite())
+            {
+                ++written;
+                buff.CommitMessageWrite(msg);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
         }
+        consumer.join();
 
-        uint32_t GetEventCount()
-        {
-            return _evtCtr;
-        }
+        EXPECT_EQ(readFailureCtr.load(), 0U);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
 
-        bool IsError()
+    auto singleSecs = run(false);
+    auto batchSecs = run(true);
+    std::cout << "\nSingle slot: " << numValues / singleSecs / 1e6 << " Mmsg/s"
+              << "\nBatch of " << batchSize << ": " << numValues / batchSecs / 1e6 << " Mmsg/s" << std::endl;
+}
+
+TEST(MPMCSeqRingBuffer, basic_equeue_dequeue)
+{
+    leopard::utils::MPMCSeqRingBuffer<RingBufferMessage> buff;
+    std::size_t capacity = 13;
+    std::size_t realCapacity = 16;
+    ASSERT_TRUE(buff.Init(capacity));
+    ASSERT_FALSE(buff.Init(capacity));
+    ASSERT_EQ(buff.GetCapacity(), realCapacity);
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+
+    // Enqueue, committing out of order must not block anyone.
+    std::vector<RingBufferMessage*> writeMsgVect;
+    for (std::size_t i = 0; i < realCapacity; ++i)
+    {
+        auto writeMsg = buff.GetMessageForWrite();
+        ASSERT_TRUE(writeMsg);
+        ASSERT_EQ(writeMsg->_seq, i);
+        writeMsgVect.push_back(writeMsg);
+    }
+    ASSERT_FALSE(buff.GetMessageForWrite());
+    ASSERT_EQ(buff.GetMessageNumber(), realCapacity);
+
+    buff.CommitMessageWrite(writeMsgVect[1]);
+    ASSERT_FALSE(buff.GetMessageForRead()); // Slot 0 is still being written.
+    buff.CommitMessageWrite(writeMsgVect[0]);
+    for (std::size_t i = 2; i < realCapacity; ++i)
+    {
+        buff.CommitMessageWrite(writeMsgVect[i]);
+    }
+
+    // Dequeue
+    std::vector<const RingBufferMessage*> readMsgVect;
+    for (std::size_t i = 0; i < realCapacity; ++i)
+    {
+        auto readMsg = buff.GetMessageForRead();
+        ASSERT_TRUE(readMsg);
+        ASSERT_EQ(readMsg->_seq, i);
+        readMsgVect.push_back(readMsg);
+    }
+    ASSERT_FALSE(buff.GetMessageForRead());
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+
+    // Releasing a later slot frees only that slot.
+    buff.CommitMessageRead(readMsgVect[1]);
+    ASSERT_FALSE(buff.GetMessageForWrite());
+    buff.CommitMessageRead(readMsgVect[0]);
+    auto writeMsg = buff.GetMessageForWrite();
+    ASSERT_TRUE(writeMsg);
+    ASSERT_EQ(writeMsg->_seq, realCapacity);
+}
+
+TEST(MPMCSeqRingBuffer, multiple_producer_multiple_consumer)
+{
+    MultipleProducerMultipleConsumer<leopard::utils::MPMCSeqRingBuffer<RingBufferMessage>>();
+}
+
+TEST(SPSCRingBuffer, basic_equeue_dequeue)
+{
+    leopard::utils::SPSCRingBuffer<uint64_t, 16> buff;
+    ASSERT_EQ(buff.GetCapacity(), 16U);
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+    ASSERT_FALSE(buff.GetMessageForRead());
+
+    for (uint64_t i = 0; i < buff.GetCapacity(); ++i)
+    {
+        auto writeMsg = buff.GetMessageForWrite();
+        ASSERT_TRUE(writeMsg);
+        *writeMsg = i;
+        buff.CommitMessageWrite(writeMsg);
+        ASSERT_EQ(buff.GetMessageNumber(), i + 1);
+    }
+    ASSERT_FALSE(buff.GetMessageForWrite());
+
+    for (uint64_t i = 0; i < buff.GetCapacity(); ++i)
+    {
+        auto readMsg = buff.GetMessageForRead();
+        ASSERT_TRUE(readMsg);
+        ASSERT_EQ(*readMsg, i);
+        buff.CommitMessageRead(readMsg);
+    }
+    ASSERT_FALSE(buff.GetMessageForRead());
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+}
+
+TEST(SPSCRingBuffer, single_producer_single_consumer)
+{
+    leopard::utils::SPSCRingBuffer<uint64_t, 1024> buff;
+    uint64_t numValues{1000000};
+    uint64_t readFailureCtr{0};
+
+    std::thread consumer([&](){
+        uint64_t expected = 0;
+        while (expected < numValues)
         {
-            return _err;
+            if (auto msg = buff.GetMessageForRead())
+            {
+                readFailureCtr += (*msg != expected++);
+                buff.CommitMessageRead(msg);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
         }
+    });
 
-        HandlerFunc GetHandlerFunc() override
+    for (uint64_t i = 0; i < numValues; )
+    {
+        if (auto msg = buff.GetMessageForWrite())
         {
-            return [this](){ OnEvent(); };
+            *msg = i++;
+            buff.CommitMessageWrite(msg);
         }
-
-        ErrorFunc GetErrorFunc() override
+        else
         {
-            return [this](){ OnError(); };
+            std::this_thread::yield();
         }
+    }
+    consumer.join();
 
-    private:
-        bool _err{false};
-        uint32_t _evtCtr{0};
-    };
+    ASSERT_EQ(readFailureCtr, 0U);
+    ASSERT_EQ(buff.GetMessageNumber(), 0U);
+}
 
-    struct itimerspec ts;
-    ts.it_interval.tv_sec = 3;
-    ts.it_interval.tv_nsec = 0;
-    ts.it_value.tv_sec = 3;
-    ts.it_value.tv_nsec = 0;
+TEST(BroadcastRingBuffer, multiple_producer_dependent_consumers)
+{
+    leopard::utils::BroadcastRingBuffer<RingBufferMessage> buff;
+    ASSERT_TRUE(buff.Init(13));
+    ASSERT_EQ(buff.GetCapacity(), 16U);
 
-    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
-    ASSERT_FALSE(tfd == -1);
-    int ret = timerfd_settime(tfd, 0, &ts, NULL);
-    ASSERT_FALSE(ret < 0);
+    auto strategy = buff.AddConsumer();
+    auto risk = buff.AddConsumer();
+    auto recorder = buff.AddConsumer({risk});
+    ASSERT_THROW(buff.AddConsumer({recorder + 1}), std::logic_error);
 
-    TimerFdHandler handler(tfd);
-    leopard::utils::Reactor<leopard::utils::FdAggregator> reactor;
-    ASSERT_TRUE(reactor.AddFd(tfd, EPOLLET|EPOLLIN|EPOLLERR|EPOLLRDHUP, &handler));
+    // Generate values to enqueue/dequeue
+    std::size_t numValues{10000};
+    std::vector<std::string> values;
+    for (std::size_t i = 0; i < numValues; ++i)
+    {
+        values.push_back(std::to_string(i));
+    }
 
-    auto t = std::thread(&decltype(reactor)::Run, &reactor);
-    std::this_thread::sleep_for(std::chrono::seconds(10));
-    reactor.Stop();
-    t.join();
-    close(tfd);
-    ASSERT_EQ(handler.GetEventCount(), 3U);
-    ASSERT_FALSE(handler.IsError());
-}
\ No newline at end of file
+    // Create producer threads
+    uint32_t producerNum{2};
+    std::vector<std::thread> producerThreads;
+    std::atomic<std::size_t> writeCtr{0};
+    for (uint32_t i = 0; i < producerNum; ++i)
+    {
+        producerThreads.emplace_back([&](){
+            while (writeCtr.load() < numValues)
+            {
+                if (auto msg = buff.GetMessageForWrite())
+                {
+                    if (msg->_seq < numValues) // msg->_seq can increase beyond numValues in this test.
+                    {
+                        msg->_data_pointers.push_back(values[msg->_seq].c_str());
+                    }
+                    buff.CommitMessageWrite(msg);
+                    ++writeCtr;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Every consumer must see every message in order, and the recorder only after the risk checker.
+    std::vector<std::atomic<bool>> riskSeen(numValues);
+    std::atomic<uint32_t> readFailureCtr{0};
+    auto consume = [&](std::size_t consumer) {
+        for (std::size_t expected = 0; expected < numValues; )
+        {
+            if (auto msg = buff.GetMessageForRead(consumer))
+            {
+                if ((msg->_seq != expected) || (msg->_data_pointers.size() != 1) || (msg->_data_pointers[0] != values[expected].c_str()))
+                {
+                    ++readFailureCtr;
+                }
+                if (consumer == risk)
+                {
+                    riskSeen[expected].store(true);
+                }
+                else if ((consumer == recorder) && !riskSeen[expected].load())
+                {
+                    ++readFailureCtr;
+                }
+                buff.CommitMessageRead(consumer, msg);
+                ++expected;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    };
+    std::vector<std::thread> consumerThreads;
+    for (auto consumer : {strategy, risk, recorder})
+    {
+        consumerThreads.emplace_back(consume, consumer);
+    }
+
+    for (auto &pt : producerThreads)
+    {
+        pt.join();
+    }
+
+    for (auto &ct : consumerThreads)
+    {
+        ct.join();
+    }
+
+    ASSERT_GE(writeCtr.load(), numValues);
+    ASSERT_EQ(readFailureCtr.load(), 0U);
+    ASSERT_EQ(buff.GetMessageNumber(strategy), writeCtr.load() - numValues);
+}
+
+TEST(MPMCRingBuffer, timerfd_eventfd_socket)
+{
+    class TimerFdHandler : public leopard::utils::FdEventHandler
+    {
+    public:
+        using leopard::utils::FdEventHandler::FdEventHandler;
+
+        void OnEvent()
+        {
+            uint64_t res;
+            if (read(GetFd(), &res, sizeof(res)) == sizeof(res))
+            {
+                ++_evtCtr;
+            }
+        }
+
+        void OnError()
+        {
+            _err = true;
+            close(GetFd());
+        }
+
+        uint32_t GetEventCount()
+        {
+            return _evtCtr;
+        }
+
+        bool IsError()
+        {
+            return _err;
+        }
+
+        HandlerFunc GetHandlerFunc() override
+        {
+            return [this](){ OnEvent(); };
+        }
+
+        ErrorFunc GetErrorFunc() override
+        {
+            return [this](){ OnError(); };
+        }
+
+    private:
+        bool _err{false};
+        uint32_t _evtCtr{0};
+    };
+
+    struct itimerspec ts;
+    ts.it_interval.tv_sec = 3;
+    ts.it_interval.tv_nsec = 0;
+    ts.it_value.tv_sec = 3;
+    ts.it_value.tv_nsec = 0;
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    ASSERT_FALSE(tfd == -1);
+    int ret = timerfd_settime(tfd, 0, &ts, NULL);
+    ASSERT_FALSE(ret < 0);
+
+    TimerFdHandler handler(tfd);
+    leopard::utils::Reactor<leopard::utils::FdAggregator> reactor;
+    ASSERT_TRUE(reactor.AddFd(tfd, EPOLLET|EPOLLIN|EPOLLERR|EPOLLRDHUP, &handler));
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    reactor.Stop();
+    t.join();
+    close(tfd);
+    ASSERT_EQ(handler.GetEventCount(), 3U);
+    ASSERT_FALSE(handler.IsError());
+}
+
+class TestFdAggregator : public leopard::utils::FdAggregator
+{
+public:
+    using leopard::utils::FdAggregator::CollectEvents;
+};
+
+TEST(FdAggregator, read_write_modify_remove)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+    int efd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_FALSE(efd == -1);
+
+    TestFdAggregator aggregator;
+    uint32_t readCtr{0}, writeCtr{0}, errorCtr{0}, eventCtr{0};
+
+    // The socket is writable straight away, stop polling EPOLLOUT after the first notification.
+    ASSERT_TRUE(aggregator.AddFd(sv[0], EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+        [&](){ char buf[16]; readCtr += (read(sv[0], buf, sizeof(buf)) > 0); },
+        [&](){ ++errorCtr; },
+        [&](){ ++writeCtr; aggregator.ModifyFd(sv[0], EPOLLIN | EPOLLRDHUP); }));
+    ASSERT_FALSE(aggregator.AddFd(sv[0], EPOLLIN, [](){}, [](){}));
+
+    // The eventfd removes itself from a callback.
+    ASSERT_TRUE(aggregator.AddFd(efd, EPOLLIN,
+        [&](){ uint64_t v; eventCtr += (read(efd, &v, sizeof(v)) == sizeof(v)); aggregator.RemoveFd(efd); },
+        [&](){ ++errorCtr; }));
+
+    aggregator.CollectEvents();
+    aggregator.CollectEvents();
+    ASSERT_EQ(writeCtr, 1U);
+    ASSERT_EQ(readCtr, 0U);
+
+    uint64_t one = 1;
+    ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    ASSERT_EQ(write(sv[1], "x", 1), 1);
+    aggregator.CollectEvents();
+    ASSERT_EQ(readCtr, 1U);
+    ASSERT_EQ(eventCtr, 1U);
+
+    ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    aggregator.CollectEvents();
+    ASSERT_EQ(eventCtr, 1U);
+    ASSERT_FALSE(aggregator.RemoveFd(efd));
+
+    // Peer hang-up goes to the error callback and removes the fd.
+    close(sv[1]);
+    aggregator.CollectEvents();
+    ASSERT_EQ(errorCtr, 1U);
+    ASSERT_FALSE(aggregator.ModifyFd(sv[0], EPOLLIN));
+
+    close(sv[0]);
+    close(efd);
+}
+
+TEST(FdAggregator, closed_fd_reuse)
+{
+    TestFdAggregator aggregator;
+    uint32_t staleCtr{0}, readCtr{0};
+
+    // Closed without RemoveFd(), then its number is reused by another fd.
+    int p[2];
+    ASSERT_EQ(pipe2(p, O_NONBLOCK), 0);
+    auto fd = p[0];
+    ASSERT_TRUE(aggregator.AddFd(fd, EPOLLIN, [&](){ ++staleCtr; }, [](){}));
+    close(p[0]);
+    close(p[1]);
+    int efd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_FALSE(efd == -1);
+    if (efd != fd)
+    {
+        ASSERT_EQ(dup2(efd, fd), fd);
+        close(efd);
+    }
+    ASSERT_TRUE(aggregator.AddFd(fd, EPOLLIN, [&](){ uint64_t v; readCtr += (read(fd, &v, sizeof(v)) == sizeof(v)); }, [](){}));
+    uint64_t one = 1;
+    ASSERT_EQ(write(fd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    aggregator.CollectEvents();
+    ASSERT_EQ(readCtr, 1U);
+    ASSERT_EQ(staleCtr, 0U);
+    ASSERT_TRUE(aggregator.RemoveFd(fd));
+    close(fd);
+
+    // A handler destroyed after its aggregator doesn't touch it.
+    {
+        auto receiver = std::make_unique<leopard::utils::UdpMulticastReceiver>("239.255.10.6", 0, "127.0.0.1");
+        {
+            TestFdAggregator inner;
+            ASSERT_TRUE(inner.AddFd(receiver->GetFd(), EPOLLIN, receiver.get()));
+        }
+        receiver.reset();
+    }
+}
+
+TEST(FdAggregator, hang_up_goes_to_error_callback)
+{
+    TestFdAggregator aggregator;
+    uint32_t readCtr{0}, errorCtr{0};
+
+    // A hung-up pipe reports EPOLLHUP without EPOLLRDHUP being polled, it goes to the error callback.
+    int p[2];
+    ASSERT_EQ(pipe2(p, O_NONBLOCK), 0);
+    ASSERT_TRUE(aggregator.AddFd(p[0], EPOLLIN, [&](){ ++readCtr; }, [&](){ ++errorCtr; }));
+    close(p[1]);
+    for (int i = 0; i < 3; ++i)
+    {
+        aggregator.CollectEvents();
+    }
+    ASSERT_EQ(errorCtr, 1U);
+    ASSERT_EQ(readCtr, 0U);
+    close(p[0]);
+}
+
+TEST(FdAggregator, remove_add_from_own_callback)
+{
+    // Legacy handler: its std::function is not trivially copyable, and is destroyed when the fd is removed.
+    class SelfRemovingHandler : public leopard::utils::FdEventHandler
+    {
+    public:
+        SelfRemovingHandler(int fd, TestFdAggregator &aggregator, std::shared_ptr<std::string> state)
+            : FdEventHandler(fd), _aggregator(aggregator), _state(std::move(state))
+        {
+        }
+
+        HandlerFunc GetHandlerFunc() override
+        {
+            auto state = _state;
+            auto *aggregator = &_aggregator;
+            int fd = GetFd();
+            return [state, aggregator, fd, this](){
+                uint64_t v;
+                static_cast<void>(read(fd, &v, sizeof(v)));
+                aggregator->RemoveFd(fd);
+                // The captures must still be alive after the removal.
+                _seen.append(*state);
+                if (_seen.size() == state->size())
+                {
+                    // Re-added from the callback, the new callbacks must not replace the running one.
+                    aggregator->AddFd(fd, EPOLLIN, [this, fd](){
+                        uint64_t v;
+                        static_cast<void>(read(fd, &v, sizeof(v)));
+                        _seen.append("!");
+                    }, [](){});
+                }
+                _seen.append(*state);
+            };
+        }
+
+        ErrorFunc GetErrorFunc() override
+        {
+            return [](){};
+        }
+
+        std::string _seen;
+
+    private:
+        TestFdAggregator &_aggregator;
+        std::shared_ptr<std::string> _state;
+    };
+
+    int efd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_FALSE(efd == -1);
+    auto state = std::make_shared<std::string>("a string long enough to be on the heap");
+    TestFdAggregator aggregator;
+    SelfRemovingHandler handler(efd, aggregator, state);
+    ASSERT_TRUE(aggregator.AddFd(efd, EPOLLIN, &handler));
+    ASSERT_EQ(state.use_count(), 3);
+
+    uint64_t one = 1;
+    ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    aggregator.CollectEvents();
+    ASSERT_EQ(handler._seen, *state + *state);
+    // The removed callback is destroyed once it returned.
+    ASSERT_EQ(state.use_count(), 2);
+
+    ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    aggregator.CollectEvents();
+    ASSERT_EQ(handler._seen, *state + *state + "!");
+    ASSERT_TRUE(aggregator.RemoveFd(efd));
+    close(efd);
+}
+
+TEST(FdAggregator, dispatch_throughput)
+{
+    class CounterHandler : public leopard::utils::FdEventHandler
+    {
+    public:
+        using leopard::utils::FdEventHandler::FdEventHandler;
+
+        HandlerFunc GetHandlerFunc() override
+        {
+            return [this](){ uint64_t v; _ctr += (read(GetFd(), &v, sizeof(v)) == sizeof(v)); };
+        }
+
+        ErrorFunc GetErrorFunc() override
+        {
+            return [](){};
+        }
+
+        uint64_t _ctr{0};
+    };
+
+    uint64_t numEvents{200000};
+    uint64_t one = 1;
+    int efd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_FALSE(efd == -1);
+    CounterHandler handler(efd);
+
+    // Previous design: the std::function is fetched through the virtual call on every event.
+    int epfd = epoll_create1(0);
+    ASSERT_FALSE(epfd == -1);
+    struct epoll_event ev;
+    ev.data.ptr = &handler;
+    ev.events = EPOLLIN;
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev), 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < numEvents; ++i)
+    {
+        ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+        struct epoll_event events[8];
+        int number = epoll_wait(epfd, events, 8, 0);
+        for (int j = 0; j < number; ++j)
+        {
+            static_cast<leopard::utils::FdEventHandler*>(events[j].data.ptr)->GetHandlerFunc()();
+        }
+    }
+    auto perEventSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(epfd);
+
+    // Callback stored once when the fd is added.
+    TestFdAggregator aggregator;
+    ASSERT_TRUE(aggregator.AddFd(efd, EPOLLIN, &handler));
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < numEvents; ++i)
+    {
+        ASSERT_EQ(write(efd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+        aggregator.CollectEvents();
+    }
+    auto storedSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(efd);
+
+    ASSERT_EQ(handler._ctr, 2 * numEvents);
+    std::cout << "Per-event GetHandlerFunc: " << numEvents / perEventSecs << " events/s" << std::endl
+              << "Stored callback: " << numEvents / storedSecs << " events/s" << std::endl;
+}
+
+
+class TestIoUringAggregator : public leopard::utils::IoUringAggregator
+{
+public:
+    using leopard::utils::IoUringAggregator::CollectEvents;
+};
+
+// Bind a UDP socket to a loopback ephemeral port and connect a sender socket to it.
+void CreateLoopbackUdpPair(int &receiver, int &sender)
+{
+    receiver = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    sender = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_FALSE(receiver == -1 || sender == -1);
+
+    int rcvbuf = 4 << 20;
+    setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(bind(receiver, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(getsockname(receiver, reinterpret_cast<struct sockaddr*>(&addr), &len), 0);
+    ASSERT_EQ(connect(sender, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+}
+
+TEST(IoUringAggregator, udp_loopback_vs_epoll)
+{
+    std::unique_ptr<TestIoUringAggregator> uring;
+    try
+    {
+        uring.reset(new TestIoUringAggregator());
+    }
+    catch (const std::system_error &e)
+    {
+        GTEST_SKIP() << "io_uring is not available: " << e.what();
+    }
+
+    uint64_t numMessages{512};
+    uint64_t batch{64};
+
+    // io_uring: multishot recv into provided buffers.
+    int receiver, sender;
+    CreateLoopbackUdpPair(receiver, sender);
+    uint64_t received{0}, failures{0};
+    ASSERT_TRUE(uring->AddSocket(receiver,
+        [&](const leopard::utils::IoUringAggregator::Buffer &buf) {
+            failures += (buf._size != sizeof(uint64_t)) || (*reinterpret_cast<const uint64_t*>(buf._data) != received);
+            ++received;
+            uring->ReleaseBuffer(buf);
+        },
+        [&](){ ++failures; }));
+    uring->CollectEvents();
+
+    auto syscallsBefore = uring->GetSyscallNumber();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < numMessages; )
+    {
+        for (uint64_t j = 0; j < batch; ++j, ++i)
+        {
+            ASSERT_EQ(send(sender, &i, sizeof(i), 0), static_cast<ssize_t>(sizeof(i)));
+        }
+        while (received < i)
+        {
+            uring->CollectEvents();
+        }
+    }
+    auto uringSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto uringSyscalls = uring->GetSyscallNumber() - syscallsBefore;
+    ASSERT_EQ(failures, 0U);
+    ASSERT_TRUE(uring->RemoveSocket(receiver));
+    ASSERT_FALSE(uring->RemoveSocket(receiver));
+    uring->CollectEvents();
+    close(receiver);
+    close(sender);
+
+    // epoll: readiness notification then one read() per datagram.
+    CreateLoopbackUdpPair(receiver, sender);
+    TestFdAggregator epoll;
+    uint64_t epollReceived{0}, epollSyscalls{0};
+    ASSERT_TRUE(epoll.AddFd(receiver, EPOLLIN,
+        [&](){
+            uint64_t v;
+            while (++epollSyscalls, read(receiver, &v, sizeof(v)) == sizeof(v))
+            {
+                failures += (v != epollReceived++);
+            }
+        },
+        [&](){ ++failures; }));
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < numMessages; )
+    {
+        for (uint64_t j = 0; j < batch; ++j, ++i)
+        {
+            ASSERT_EQ(send(sender, &i, sizeof(i), 0), static_cast<ssize_t>(sizeof(i)));
+        }
+        while (epollReceived < i)
+        {
+            ++epollSyscalls;
+            epoll.CollectEvents();
+        }
+    }
+    auto epollSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(failures, 0U);
+    close(receiver);
+    close(sender);
+
+    std::cout << "io_uring: " << static_cast<double>(uringSyscalls) / numMessages << " syscalls/msg, "
+              << uringSecs * 1e9 / numMessages << " ns/msg" << std::endl
+              << "epoll: " << static_cast<double>(epollSyscalls) / numMessages << " syscalls/msg, "
+              << epollSecs * 1e9 / numMessages << " ns/msg" << std::endl;
+}
+
+TEST(IoUringAggregator, tcp_hang_up)
+{
+    std::unique_ptr<TestIoUringAggregator> uring;
+    try
+    {
+        uring.reset(new TestIoUringAggregator());
+    }
+    catch (const std::system_error &e)
+    {
+        GTEST_SKIP() << "io_uring is not available: " << e.what();
+    }
+
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    std::string received;
+    uint32_t errorCtr{0};
+    ASSERT_TRUE(uring->AddSocket(sv[0],
+        [&](const leopard::utils::IoUringAggregator::Buffer &buf) {
+            received.append(buf._data, buf._size);
+            uring->ReleaseBuffer(buf);
+        },
+        [&](){ ++errorCtr; }));
+    ASSERT_FALSE(uring->AddSocket(sv[0], [](const leopard::utils::IoUringAggregator::Buffer&){}, [](){}));
+    uring->CollectEvents();
+
+    ASSERT_EQ(write(sv[1], "hello", 5), 5);
+    for (int i = 0; i < 1000 && received.size() < 5; ++i)
+    {
+        uring->CollectEvents();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(received, "hello");
+
+    close(sv[1]);
+    for (int i = 0; i < 1000 && !errorCtr; ++i)
+    {
+        uring->CollectEvents();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(errorCtr, 1U);
+    ASSERT_FALSE(uring->RemoveSocket(sv[0]));
+    close(sv[0]);
+}
+
+
+class TestTimerWheelAggregator : public leopard::utils::TimerWheelAggregator
+{
+public:
+    using leopard::utils::TimerWheelAggregator::TimerWheelAggregator;
+    using leopard::utils::TimerWheelAggregator::Advance;
+};
+
+TEST(IoUringAggregator, burst_overflow_and_buffer_exhaustion)
+{
+    using leopard::utils::IoUringAggregator;
+    std::unique_ptr<TestIoUringAggregator> uring;
+    try
+    {
+        uring.reset(new TestIoUringAggregator());
+    }
+    catch (const std::system_error &e)
+    {
+        GTEST_SKIP() << "io_uring is not available: " << e.what();
+    }
+
+    int receiver, sender;
+    CreateLoopbackUdpPair(receiver, sender);
+    uint64_t received{0}, failures{0};
+    std::vector<IoUringAggregator::Buffer> held;
+    ASSERT_TRUE(uring->AddSocket(receiver,
+        [&](const IoUringAggregator::Buffer &buf) {
+            failures += (buf._size != sizeof(uint64_t)) || (*reinterpret_cast<const uint64_t*>(buf._data) != received);
+            ++received;
+            held.push_back(buf);
+        },
+        [&](){ ++failures; }));
+    uring->CollectEvents();
+
+    // More datagrams than CQ entries before any is reaped, and more than buffers while none is released.
+    uint64_t numMessages{IoUringAggregator::BUFFER_NUMBER + 100};
+    for (uint64_t i = 0; i < numMessages; ++i)
+    {
+        ASSERT_EQ(send(sender, &i, sizeof(i), 0), static_cast<ssize_t>(sizeof(i)));
+    }
+    for (uint32_t i = 0; (i < 1000) && (received < IoUringAggregator::BUFFER_NUMBER); ++i)
+    {
+        uring->CollectEvents();
+    }
+    ASSERT_EQ(received, IoUringAggregator::BUFFER_NUMBER);
+
+    // Out of buffers: the request is not re-armed on every pass.
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        uring->CollectEvents();
+    }
+    auto syscalls = uring->GetSyscallNumber();
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        uring->CollectEvents();
+    }
+    ASSERT_EQ(uring->GetSyscallNumber(), syscalls);
+    ASSERT_EQ(received, IoUringAggregator::BUFFER_NUMBER);
+
+    // Released buffers re-arm it, the datagrams left in the socket come in.
+    for (auto &buf : held)
+    {
+        uring->ReleaseBuffer(buf);
+    }
+    held.clear();
+    for (uint32_t i = 0; (i < 1000) && (received < numMessages); ++i)
+    {
+        uring->CollectEvents();
+    }
+    ASSERT_EQ(received, numMessages);
+    ASSERT_EQ(failures, 0U);
+    for (auto &buf : held)
+    {
+        uring->ReleaseBuffer(buf);
+    }
+    ASSERT_TRUE(uring->RemoveSocket(receiver));
+    uring->CollectEvents();
+    close(receiver);
+    close(sender);
+}
+
+TEST(IoUringAggregator, reactor_remove_from_callback)
+{
+    using leopard::utils::IoUringAggregator;
+    using UringReactor = leopard::utils::Reactor<leopard::utils::FdAggregator, IoUringAggregator>;
+    std::unique_ptr<UringReactor> reactor;
+    try
+    {
+        reactor.reset(new UringReactor());
+    }
+    catch (const std::system_error &e)
+    {
+        GTEST_SKIP() << "io_uring is not available: " << e.what();
+    }
+    ASSERT_TRUE(reactor->EnableBlocking(*reactor));
+    reactor->SetWaitPolicy(leopard::utils::WaitPolicy::Block());
+
+    int receiver, sender;
+    CreateLoopbackUdpPair(receiver, sender);
+    // Not trivially copyable, so it's destroyed with the callback.
+    auto state = std::make_shared<std::atomic<uint64_t>>(0);
+    ASSERT_TRUE(reactor->AddSocket(receiver,
+        [state, &reactor, receiver](const IoUringAggregator::Buffer &buf) {
+            reactor->ReleaseBuffer(buf);
+            reactor->RemoveSocket(receiver);
+            // The captures must still be alive after the removal.
+            state->fetch_add(1);
+        },
+        [](){}));
+    ASSERT_EQ(state.use_count(), 2);
+
+    std::thread t([&](){ reactor->Run(); });
+    uint64_t value{1};
+    ASSERT_EQ(send(sender, &value, sizeof(value), 0), static_cast<ssize_t>(sizeof(value)));
+    ASSERT_EQ(send(sender, &value, sizeof(value), 0), static_cast<ssize_t>(sizeof(value)));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ((state->load() == 0) && (std::chrono::steady_clock::now() < deadline))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reactor->Stop();
+    t.join();
+
+    // Only the first datagram is handled, and the callback is destroyed once it returned.
+    ASSERT_EQ(state->load(), 1U);
+    ASSERT_EQ(state.use_count(), 1);
+    close(receiver);
+    close(sender);
+}
+
+TEST(IoUringAggregator, re_add_from_own_callback)
+{
+    using leopard::utils::IoUringAggregator;
+    std::unique_ptr<TestIoUringAggregator> aggregator;
+    try
+    {
+        aggregator.reset(new TestIoUringAggregator());
+    }
+    catch (const std::system_error &e)
+    {
+        GTEST_SKIP() << "io_uring is not available: " << e.what();
+    }
+
+    int receiver, sender;
+    CreateLoopbackUdpPair(receiver, sender);
+
+    // Each datagram replaces the socket's entry while its callback runs, the replaced ones are freed as their
+    // request is cancelled.
+    uint64_t received{0};
+    std::function<void(const IoUringAggregator::Buffer&)> onRecv = [&](const IoUringAggregator::Buffer &buf) {
+        aggregator->ReleaseBuffer(buf);
+        ++received;
+        aggregator->RemoveSocket(receiver);
+        aggregator->AddSocket(receiver, onRecv, [](){});
+    };
+    ASSERT_TRUE(aggregator->AddSocket(receiver, onRecv, [](){}));
+
+    constexpr uint64_t numDatagrams{500};
+    for (uint64_t i = 0; i < numDatagrams; ++i)
+    {
+        ASSERT_EQ(send(sender, &i, sizeof(i), 0), static_cast<ssize_t>(sizeof(i)));
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((received <= i) && (std::chrono::steady_clock::now() < deadline))
+        {
+            aggregator->CollectEvents();
+        }
+        // Submit the cancel of the replaced request, it would otherwise take the next datagram and drop it.
+        aggregator->CollectEvents();
+    }
+    ASSERT_EQ(received, numDatagrams);
+    ASSERT_TRUE(aggregator->RemoveSocket(receiver));
+    aggregator->CollectEvents();
+    close(receiver);
+    close(sender);
+}
+
+TEST(TimerWheelAggregator, schedule_cancel_cascade)
+{
+    uint64_t tick = 1000;
+    TestTimerWheelAggregator wheel(tick);
+    auto base = (TestTimerWheelAggregator::Now() / tick + 1) * tick;
+
+    // Delays (in ticks) covering every level and beyond the range of the wheel.
+    std::vector<uint64_t> delays{1, 5, 255, 256, 300, 65536, 70000, 16777216 + 3, (1ULL << 32) + 7};
+    std::vector<uint64_t> firedAt(delays.size(), 0);
+    uint64_t now = base;
+    std::vector<std::unique_ptr<leopard::utils::TimerNode>> nodes;
+    for (std::size_t i = 0; i < delays.size(); ++i)
+    {
+        nodes.emplace_back(new leopard::utils::TimerNode([&firedAt, &now, i](){ firedAt[i] = now; }));
+        wheel.ScheduleAt(*nodes[i], base + delays[i] * tick);
+    }
+
+    leopard::utils::TimerNode cancelled([](){ FAIL() << "Cancelled timer fired"; });
+    wheel.ScheduleAt(cancelled, base + 10 * tick);
+    {
+        leopard::utils::TimerNode destroyed([](){ FAIL() << "Destroyed timer fired"; });
+        wheel.ScheduleAt(destroyed, base + 10 * tick);
+    }
+    ASSERT_EQ(wheel.GetTimerNumber(), delays.size() + 1);
+    ASSERT_TRUE(wheel.Cancel(cancelled));
+    ASSERT_FALSE(wheel.Cancel(cancelled));
+    ASSERT_EQ(wheel.GetTimerNumber(), delays.size());
+
+    // A periodic timer re-scheduling itself from its callback.
+    uint32_t periodicCtr{0};
+    leopard::utils::TimerNode periodic;
+    periodic.SetCallback([&periodicCtr, &wheel, &periodic, &now](){ if (++periodicCtr < 3) wheel.ScheduleAt(periodic, now + 100000); });
+    wheel.ScheduleAt(periodic, base + 100 * tick);
+
+    // Advance in steps of varying size, every timer must fire on the first step at or after its deadline.
+    for (uint64_t step : {1ULL, 3ULL, 97ULL, 1ULL, 1000ULL, 123456ULL, 1ULL << 25, 1ULL << 31, 1ULL << 31, 1ULL << 31})
+    {
+        auto prev = now;
+        now += step * tick;
+        wheel.Advance(now);
+        for (std::size_t i = 0; i < delays.size(); ++i)
+        {
+            auto deadline = base + delays[i] * tick;
+            if ((deadline > prev) && (deadline <= now))
+            {
+                ASSERT_EQ(firedAt[i], now) << "delay=" << delays[i];
+            }
+        }
+    }
+    for (std::size_t i = 0; i < delays.size(); ++i)
+    {
+        ASSERT_TRUE(firedAt[i]) << "delay=" << delays[i];
+    }
+    ASSERT_EQ(periodicCtr, 3U);
+    ASSERT_EQ(wheel.GetTimerNumber(), 0U);
+}
+
+TEST(TimerWheelAggregator, expiry_on_level_boundary)
+{
+    uint64_t tick = 1000;
+    TestTimerWheelAggregator wheel(tick);
+    auto current = TestTimerWheelAggregator::Now() / tick;
+
+    // Parked in level 1 and level 2, both cascaded on the very tick they expire.
+    std::vector<uint64_t> expiries{((current >> 8) + 2) << 8, ((current >> 16) + 2) << 16};
+    for (auto expiry : expiries)
+    {
+        bool fired{false};
+        leopard::utils::TimerNode node([&fired](){ fired = true; });
+        wheel.ScheduleAt(node, expiry * tick);
+        wheel.Advance((expiry - 1) * tick);
+        ASSERT_FALSE(fired);
+        ASSERT_EQ(wheel.Advance(expiry * tick), 1U);
+        ASSERT_TRUE(fired) << "expiry=" << expiry;
+    }
+}
+
+TEST(TimerWheelAggregator, reactor)
+{
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::TimerWheelAggregator> reactor;
+    std::atomic<uint32_t> heartbeatCtr{0};
+    std::atomic<uint64_t> timeoutAt{0};
+
+    auto start = leopard::utils::TimerWheelAggregator::Now();
+    leopard::utils::TimerNode heartbeat;
+    heartbeat.SetCallback([&](){ ++heartbeatCtr; reactor.Schedule(heartbeat, 10000000); });
+    leopard::utils::TimerNode timeout([&](){ timeoutAt = leopard::utils::TimerWheelAggregator::Now(); });
+    reactor.Schedule(heartbeat, 10000000);
+    reactor.Schedule(timeout, 50000000);
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    std::this_thread::sleep_for(std::chrono::milliseconds(105));
+    reactor.Stop();
+    t.join();
+
+    ASSERT_GE(heartbeatCtr.load(), 5U);
+    ASSERT_LE(heartbeatCtr.load(), 10U);
+    ASSERT_GE(timeoutAt.load(), start + 50000000);
+}
+
+
+template <typename Queue>
+class TestQueueAggregator : public leopard::utils::QueueAggregator<Queue>
+{
+public:
+    using leopard::utils::QueueAggregator<Queue>::CollectEvents;
+};
+
+TEST(QueueAggregator, drain_budget_doorbell)
+{
+    TestQueueAggregator<leopard::utils::SPSCRingBuffer<uint64_t, 16>> aggregator;
+    std::vector<uint64_t> handled;
+    aggregator.SetQueueHandler([&handled](const uint64_t &v){ handled.push_back(v); });
+    aggregator.SetDrainBudget(4);
+    int doorbell = aggregator.EnableDoorbell();
+
+    for (uint64_t i = 0; i < 10; ++i)
+    {
+        ASSERT_TRUE(aggregator.Post([i](uint64_t &v){ v = i; }));
+    }
+    for (std::size_t expected : {4U, 8U, 10U, 10U})
+    {
+        aggregator.CollectEvents();
+        ASSERT_EQ(handled.size(), expected);
+    }
+    for (uint64_t i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(handled[i], i);
+    }
+
+    // The reactor went idle on the empty queue, so only the first post rings the doorbell.
+    uint64_t value{0};
+    ASSERT_EQ(read(doorbell, &value, sizeof(value)), -1);
+    ASSERT_TRUE(aggregator.Post([](uint64_t &v){ v = 10; }));
+    ASSERT_TRUE(aggregator.Post([](uint64_t &v){ v = 11; }));
+    ASSERT_EQ(read(doorbell, &value, sizeof(value)), static_cast<ssize_t>(sizeof(value)));
+    ASSERT_EQ(value, 1U);
+
+    // Busy queue, no doorbell.
+    aggregator.CollectEvents();
+    ASSERT_EQ(handled.size(), 12U);
+    ASSERT_TRUE(aggregator.Post([](uint64_t &v){ v = 12; }));
+    aggregator.CollectEvents();
+    ASSERT_EQ(handled.size(), 13U);
+    ASSERT_EQ(read(doorbell, &value, sizeof(value)), -1);
+}
+
+TEST(QueueAggregator, cross_thread_closures)
+{
+    struct TaskMessage
+    {
+        std::size_t _seq{0};
+        std::vector<const char*> _data_pointers;
+        leopard::utils::Delegate<void()> _task;
+    };
+
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::QueueAggregator<leopard::utils::MPMCRingBuffer<TaskMessage>>> reactor;
+    ASSERT_TRUE(reactor.GetQueue().Init(64));
+    ASSERT_TRUE(reactor.EnableDoorbell(reactor));
+    reactor.SetQueueHandler([](const TaskMessage &msg){ msg._task(); });
+
+    // Only touched by the reactor thread, so no synchronization needed.
+    uint64_t sum{0};
+    uint32_t producerNum{2};
+    uint64_t numTasks{10000};
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    std::vector<std::thread> producerThreads;
+    for (uint32_t p = 0; p < producerNum; ++p)
+    {
+        producerThreads.emplace_back([&](){
+            for (uint64_t i = 1; i <= numTasks; )
+            {
+                if (reactor.Post([&sum, i](TaskMessage &msg){ msg._task = [&sum, i](){ sum += i; }; }))
+                {
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &pt : producerThreads)
+    {
+        pt.join();
+    }
+
+    // The last task posted runs after all the others.
+    std::atomic<bool> done{false};
+    while (!reactor.Post([&done](TaskMessage &msg){ msg._task = [&done](){ done = true; }; }))
+    {
+        std::this_thread::yield();
+    }
+    while (!done.load())
+    {
+        std::this_thread::yield();
+    }
+    reactor.Stop();
+    t.join();
+
+    ASSERT_EQ(sum, producerNum * numTasks * (numTasks + 1) / 2);
+}
+
+TEST(Reactor, block_wait_policy)
+{
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::TimerWheelAggregator, leopard::utils::QueueAggregator<leopard::utils::SPSCRingBuffer<uint64_t, 64>>> reactor;
+    reactor.SetWaitPolicy(leopard::utils::WaitPolicy::Block());
+    ASSERT_TRUE(reactor.EnableDoorbell(reactor));
+
+    std::atomic<uint64_t> timerAt{0};
+    std::atomic<uint64_t> handledAt{0};
+    std::atomic<uint64_t> handledValue{0};
+    leopard::utils::TimerNode timer([&](){ timerAt = leopard::utils::TimerWheelAggregator::Now(); });
+    reactor.SetQueueHandler([&](const uint64_t &v){ handledValue = v; handledAt = leopard::utils::TimerWheelAggregator::Now(); });
+
+    auto start = leopard::utils::TimerWheelAggregator::Now();
+    reactor.Schedule(timer, 20000000);
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+
+    // The reactor sleeps until the timer, then until the doorbell.
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    auto postAt = leopard::utils::TimerWheelAggregator::Now();
+    ASSERT_TRUE(reactor.Post([](uint64_t &v){ v = 42; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(handledValue.load(), 42U);
+
+    // Stop wakes it up straight away, even though it'd block forever otherwise.
+    auto stopAt = leopard::utils::TimerWheelAggregator::Now();
+    reactor.Stop();
+    t.join();
+    auto stoppedAt = leopard::utils::TimerWheelAggregator::Now();
+
+    ASSERT_GE(timerAt.load(), start + 20000000);
+    ASSERT_LT(timerAt.load(), start + 35000000);
+    ASSERT_GE(handledAt.load(), postAt);
+    ASSERT_LT(handledAt.load(), postAt + 10000000);
+    ASSERT_LT(stoppedAt - stopAt, 10000000U);
+
+    // A busy-polling reactor would have done millions of empty polls by now.
+    ASSERT_GT(reactor.GetBlockNumber(), 0U);
+    ASSERT_LT(reactor.GetEmptyPollNumber(), 100U);
+    ASSERT_GE(reactor.GetProductivePollNumber(), 2U);
+    std::cout << "Blocking reactor: empty_polls=" << reactor.GetEmptyPollNumber() << ", productive_polls="
+              << reactor.GetProductivePollNumber() << ", blocks=" << reactor.GetBlockNumber() << std::endl;
+}
+
+TEST(Reactor, spin_block_wait_policy)
+{
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::TimerWheelAggregator> reactor;
+    reactor.SetWaitPolicy(leopard::utils::WaitPolicy::SpinBlock(1000000, 1000000));
+    std::atomic<uint32_t> timerCtr{0};
+    leopard::utils::TimerNode timer([&](){ ++timerCtr; });
+    reactor.Schedule(timer, 5000000);
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    reactor.Stop();
+    t.join();
+
+    // Spins for 1ms after the start and after the timer, blocks 1ms at most otherwise.
+    ASSERT_EQ(timerCtr.load(), 1U);
+    ASSERT_GT(reactor.GetEmptyPollNumber(), reactor.GetBlockNumber());
+    ASSERT_GT(reactor.GetBlockNumber(), 0U);
+    ASSERT_LE(reactor.GetBlockNumber(), 40U);
+}
+
+TEST(Reactor, spin_wait_policy)
+{
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::TimerWheelAggregator> reactor;
+    reactor.SetWaitPolicy(leopard::utils::WaitPolicy::Spin());
+    std::atomic<uint32_t> timerCtr{0};
+    leopard::utils::TimerNode timer([&](){ ++timerCtr; });
+    reactor.Schedule(timer, 5000000);
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reactor.Stop();
+    t.join();
+
+    // Never blocks, even with nothing to do.
+    ASSERT_EQ(timerCtr.load(), 1U);
+    ASSERT_EQ(reactor.GetBlockNumber(), 0U);
+    ASSERT_GT(reactor.GetEmptyPollNumber(), 100U);
+}
+
+TEST(Reactor, block_timer_precision)
+{
+    leopard::utils::Reactor<leopard::utils::FdAggregator, leopard::utils::TimerWheelAggregator> reactor;
+    reactor.SetWaitPolicy(leopard::utils::WaitPolicy::Block());
+
+    // Sub-milli-second timers, each scheduled from the previous one: the reactor blocks in between.
+    constexpr uint32_t numTimers{20};
+    constexpr uint64_t delay{300000};
+    std::vector<uint64_t> lateness;
+    uint64_t deadline{0};
+    leopard::utils::TimerNode timer;
+    timer.SetCallback([&](){
+        lateness.push_back(leopard::utils::TimerWheelAggregator::Now() - deadline);
+        if (lateness.size() < numTimers)
+        {
+            deadline = leopard::utils::TimerWheelAggregator::Now() + delay;
+            reactor.ScheduleAt(timer, deadline);
+        }
+    });
+    deadline = leopard::utils::TimerWheelAggregator::Now() + delay;
+    reactor.ScheduleAt(timer, deadline);
+
+    auto t = std::thread(&decltype(reactor)::Run, &reactor);
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ((reactor.GetTimerNumber() > 0) && (std::chrono::steady_clock::now() < until))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    reactor.Stop();
+    t.join();
+
+    // Rounding the timeout up to milli-seconds would make most of them ~700us late.
+    ASSERT_EQ(lateness.size(), numTimers);
+    std::sort(lateness.begin(), lateness.end());
+    ASSERT_LT(lateness[numTimers / 2], 500000U);
+    ASSERT_GT(reactor.GetBlockNumber(), 0U);
+    std::cout << "Blocking timer lateness: p50=" << lateness[numTimers / 2] << "ns, max=" << lateness.back() << "ns" << std::endl;
+}
+
+TEST(FixedSizePool, allocate_deallocate)
+{
+    leopard::utils::FixedSizePool pool;
+    ASSERT_TRUE(pool.Init(100, 256));
+    ASSERT_FALSE(pool.Init(100, 256));
+    ASSERT_EQ(pool.GetBlockSize() % alignof(std::max_align_t), 0U);
+    ASSERT_GE(pool.GetBlockSize(), 100U);
+    std::cout << "Pool on huge pages: " << pool.IsHugePage() << std::endl;
+
+    std::vector<char*> blocks;
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        auto *block = static_cast<char*>(pool.Allocate());
+        ASSERT_TRUE(block);
+        std::memset(block, static_cast<int>(i), pool.GetBlockSize());
+        blocks.push_back(block);
+    }
+    ASSERT_FALSE(pool.Allocate());
+
+    // All distinct and untouched by each other.
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        ASSERT_EQ(blocks[i][0], static_cast<char>(i));
+        ASSERT_EQ(blocks[i][pool.GetBlockSize() - 1], static_cast<char>(i));
+    }
+    for (auto *block : blocks)
+    {
+        pool.Deallocate(block);
+    }
+
+    auto *str = pool.New<std::pair<uint64_t, uint64_t>>(1, 2);
+    ASSERT_TRUE(str);
+    ASSERT_EQ(str->second, 2U);
+    pool.Delete(str);
+    ASSERT_FALSE((pool.New<std::array<char, 200>>()));
+
+    leopard::utils::InlineVector<std::string, 2> strings;
+    ASSERT_TRUE(strings.push_back("a"));
+    ASSERT_TRUE(strings.emplace_back(3, 'b'));
+    ASSERT_FALSE(strings.push_back("c"));
+    ASSERT_EQ(strings.size(), 2U);
+    ASSERT_EQ(strings[1], "bbb");
+    auto copy = strings;
+    strings.clear();
+    ASSERT_TRUE(strings.empty());
+    ASSERT_EQ(copy[0], "a");
+}
+
+TEST(FixedSizePool, ring_buffer_payloads_without_malloc)
+{
+    struct PayloadMessage
+    {
+        std::size_t _seq{0};
+        // Cleared by MPMCRingBuffer::GetMessageForWrite(), without freeing anything.
+        leopard::utils::InlineVector<char*, 4> _data_pointers;
+    };
+
+    uint32_t producerNum{2};
+    uint32_t consumerNum{2};
+    uint64_t numMessages{10000};
+
+    // Slack for the blocks cached by each thread.
+    leopard::utils::FixedSizePool pool;
+    ASSERT_TRUE(pool.Init(64, 8192));
+    leopard::utils::MPMCRingBuffer<PayloadMessage> buff;
+    ASSERT_TRUE(buff.Init(256));
+
+    std::atomic<uint64_t> producerAllocations{0};
+    std::atomic<uint64_t> consumerAllocations{0};
+    std::atomic<uint64_t> readCtr{0};
+    std::atomic<uint64_t> payloadSum{0};
+    std::atomic<bool> corrupted{false};
+
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producerNum; ++p)
+    {
+        threads.emplace_back([&](){
+            auto start = tAllocationCtr;
+            for (uint64_t i = 0; i < numMessages; )
+            {
+                auto *msg = buff.GetMessageForWrite();
+                if (!msg)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (uint64_t n = 0; n <= i % 4; ++n)
+                {
+                    char *payload;
+                    while (!(payload = static_cast<char*>(pool.Allocate())))
+                    {
+                        std::this_thread::yield();
+                    }
+                    auto value = i + n;
+                    std::memcpy(payload, &value, sizeof(value));
+                    std::memcpy(payload + pool.GetBlockSize() - sizeof(value), &value, sizeof(value));
+                    msg->_data_pointers.push_back(payload);
+                }
+                buff.CommitMessageWrite(msg);
+                ++i;
+            }
+            producerAllocations += tAllocationCtr - start;
+        });
+    }
+    for (uint32_t c = 0; c < consumerNum; ++c)
+    {
+        threads.emplace_back([&](){
+            auto start = tAllocationCtr;
+            while (readCtr.load() < producerNum * numMessages)
+            {
+                auto *msg = buff.GetMessageForRead();
+                if (!msg)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (auto *payload : msg->_data_pointers)
+                {
+                    uint64_t head, tail;
+                    std::memcpy(&head, payload, sizeof(head));
+                    std::memcpy(&tail, payload + pool.GetBlockSize() - sizeof(tail), sizeof(tail));
+                    if (head != tail)
+                    {
+                        corrupted = true;
+                    }
+                    payloadSum += head;
+                    pool.Deallocate(payload);
+                }
+                buff.CommitMessageRead(msg);
+                ++readCtr;
+            }
+            consumerAllocations += tAllocationCtr - start;
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    // Per message i: payloads i..i+(i%4).
+    uint64_t expectedSum{0};
+    for (uint64_t i = 0; i < numMessages; ++i)
+    {
+        for (uint64_t n = 0; n <= i % 4; ++n)
+        {
+            expectedSum += i + n;
+        }
+    }
+    ASSERT_FALSE(corrupted.load());
+    ASSERT_EQ(payloadSum.load(), producerNum * expectedSum);
+    ASSERT_EQ(producerAllocations.load(), 0U);
+    ASSERT_EQ(consumerAllocations.load(), 0U);
+}
+
+std::vector<std::string> ReadLines(const std::string &path)
+{
+    std::vector<std::string> lines;
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line); )
+    {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+TEST(Logger, background_formatting)
+{
+    enum class Side { buy = 1, sell = 2 };
+
+    auto path = std::string("/tmp/leopard_logger_test_") + std::to_string(getpid()) + ".log";
+    std::remove(path.c_str());
+    auto &logger = leopard::utils::Logger::GetInstance();
+    leopard::utils::ThreadAttributes attributes;
+    attributes._name = "test-logger";
+    ASSERT_TRUE(logger.Start(path, attributes));
+    ASSERT_FALSE(logger.Start(path));
+
+    uint32_t threadNum{2};
+    uint32_t numRecords{1000};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadNum; ++t)
+    {
+        threads.emplace_back([t, numRecords](){
+            std::string venue("XLON");
+            for (uint32_t i = 0; i < numRecords; ++i)
+            {
+                LEOPARD_LOG_INFO("Order: thread={}, seq={}, px={}, venue={}, side={}, ioc={}", t, i, 100.5, venue, Side::sell, i % 2 == 0);
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    LEOPARD_LOG_DEBUG("Filtered out by the default level");
+    LEOPARD_LOG_ERROR("Escaped {} braces {", "no");
+    logger.Stop();
+
+    auto lines = ReadLines(path);
+    std::remove(path.c_str());
+    ASSERT_EQ(lines.size(), threadNum * numRecords + 1);
+    ASSERT_NE(lines[0].find(" INFO  test_utils.cxx:"), std::string::npos);
+    ASSERT_NE(lines[0].find("px=100.500000, venue=XLON, side=2, ioc=true"), std::string::npos);
+    ASSERT_NE(lines.back().find(" ERROR test_utils.cxx:"), std::string::npos);
+    ASSERT_NE(lines.back().find("Escaped no braces {"), std::string::npos);
+
+    // The records of each thread are in order.
+    std::vector<uint32_t> nextSeq(threadNum, 0);
+    for (std::size_t i = 0; i + 1 < lines.size(); ++i)
+    {
+        auto t = std::stoul(lines[i].substr(lines[i].find("thread=") + 7));
+        auto seq = std::stoul(lines[i].substr(lines[i].find("seq=") + 4));
+        ASSERT_EQ(seq, nextSeq[t]++);
+    }
+}
+
+TEST(Logger, full_ring_policies)
+{
+    auto path = std::string("/tmp/leopard_logger_test_") + std::to_string(getpid()) + ".log";
+    auto &logger = leopard::utils::Logger::GetInstance();
+    std::string payload(1000, 'x');
+    uint32_t numRecords{1000};
+
+    for (auto policy : {leopard::utils::Logger::FullPolicy::drop, leopard::utils::Logger::FullPolicy::block})
+    {
+        std::remove(path.c_str());
+        auto dropped = logger.GetDropNumber();
+        ASSERT_TRUE(logger.Start(path, leopard::utils::ThreadAttributes(), policy, 4096));
+        for (uint32_t i = 0; i < numRecords; ++i)
+        {
+            LEOPARD_LOG_WARN("Record {}: {}", i, payload);
+        }
+        logger.Stop();
+        dropped = logger.GetDropNumber() - dropped;
+
+        std::size_t records{0};
+        uint64_t reportedDrops{0};
+        for (auto &line : ReadLines(path))
+        {
+            if (line.find("Dropped ") == 0)
+            {
+                reportedDrops += std::stoull(line.substr(8));
+            }
+            else
+            {
+                ++records;
+            }
+        }
+        ASSERT_EQ(records + dropped, numRecords);
+        ASSERT_EQ(reportedDrops, dropped);
+        if (policy == leopard::utils::Logger::FullPolicy::block)
+        {
+            ASSERT_EQ(dropped, 0U);
+        }
+        std::cout << "Records written: " << records << ", dropped: " << dropped << std::endl;
+    }
+    std::remove(path.c_str());
+}
+
+TEST(Logger, ring_capacity_change)
+{
+    auto path = std::string("/tmp/leopard_logger_test_") + std::to_string(getpid()) + ".log";
+    auto &logger = leopard::utils::Logger::GetInstance();
+    std::string payload(1000, 'x');
+
+    // The ring of this thread is created small, then a record too large for it but not for the new capacity
+    // is logged, which must neither be dropped nor block forever.
+    for (auto capacity : {std::size_t{4096}, std::size_t{65536}})
+    {
+        std::remove(path.c_str());
+        auto dropped = logger.GetDropNumber();
+        ASSERT_TRUE(logger.Start(path, leopard::utils::ThreadAttributes(), leopard::utils::Logger::FullPolicy::block, capacity));
+        LEOPARD_LOG_WARN("Large record: {} {} {} {} {}", payload, payload, payload, payload, payload);
+        logger.Stop();
+
+        auto lines = ReadLines(path);
+        if (capacity == 4096)
+        {
+            ASSERT_EQ(logger.GetDropNumber() - dropped, 1U);
+        }
+        else
+        {
+            ASSERT_EQ(logger.GetDropNumber(), dropped);
+            ASSERT_EQ(lines.size(), 1U);
+            ASSERT_NE(lines[0].find(payload), std::string::npos);
+        }
+    }
+    std::remove(path.c_str());
+}
+
+TEST(Histogram, percentiles_merge)
+{
+    leopard::utils::Histogram histogram;
+    ASSERT_EQ(histogram.GetPercentile(50), 0U);
+    ASSERT_EQ(histogram.GetMin(), 0U);
+
+    for (uint64_t i = 1; i <= 100000; ++i)
+    {
+        histogram.Record(i);
+    }
+    ASSERT_EQ(histogram.GetCount(), 100000U);
+    ASSERT_EQ(histogram.GetMin(), 1U);
+    ASSERT_EQ(histogram.GetMax(), 100000U);
+    ASSERT_DOUBLE_EQ(histogram.GetMean(), 50000.5);
+    // Values are exact below 128, then within 1 / 128 of the exact percentile.
+    ASSERT_EQ(histogram.GetPercentile(0.1), 100U);
+    for (double percentile : {50.0, 90.0, 99.0, 99.9})
+    {
+        auto exact = percentile * 1000;
+        auto value = static_cast<double>(histogram.GetPercentile(percentile));
+        ASSERT_GE(value, exact);
+        ASSERT_LE(value, exact * (1 + 1.0 / 128));
+    }
+    ASSERT_EQ(histogram.GetPercentile(100), 100000U);
+
+    leopard::utils::Histogram outliers;
+    outliers.Record(0);
+    outliers.Record(UINT64_MAX);
+    auto merged = histogram;
+    merged.Merge(outliers);
+    ASSERT_EQ(merged.GetCount(), 100002U);
+    ASSERT_EQ(merged.GetMin(), 0U);
+    ASSERT_EQ(merged.GetMax(), UINT64_MAX);
+    ASSERT_EQ(merged.GetPercentile(50), histogram.GetPercentile(50));
+
+    merged.Reset();
+    ASSERT_EQ(merged.GetCount(), 0U);
+    ASSERT_EQ(merged.GetPercentile(99), 0U);
+}
+
+namespace
+{
+    struct ShmMessage
+    {
+        uint64_t _id;
+        uint64_t _checksum;
+        char _text[16];
+    };
+}
+
+TEST(ShmRingBuffer, create_attach_layout_check)
+{
+    auto name = std::string("leopard_shm_test_") + std::to_string(getpid());
+    leopard::utils::ShmRingBuffer<ShmMessage>::Remove(name);
+
+    leopard::utils::ShmRingBuffer<ShmMessage> creator;
+    ASSERT_FALSE(creator.Attach(name));
+    ASSERT_TRUE(creator.Create(name, 100, false, 3));
+    ASSERT_EQ(creator.GetCapacity(), 128U);
+
+    // Each name is created once, whoever the creator is.
+    leopard::utils::ShmRingBuffer<ShmMessage> other;
+    ASSERT_FALSE(other.Create(name, 100));
+
+    // Mismatching type version or type layout.
+    ASSERT_FALSE(other.Attach(name));
+    ASSERT_FALSE(other.Attach(name, 4));
+    leopard::utils::ShmRingBuffer<uint64_t> wrongType;
+    ASSERT_FALSE(wrongType.Attach(name, 3));
+
+    leopard::utils::ShmRingBuffer<ShmMessage> attached;
+    ASSERT_TRUE(attached.Attach(name, 3));
+    ASSERT_EQ(attached.GetCapacity(), 128U);
+
+    // Both mappings share the counters and the slots.
+    for (uint64_t i = 0; i < 128; ++i)
+    {
+        auto *msg = creator.GetMessageForWrite();
+        ASSERT_TRUE(msg != nullptr);
+        msg->_id = i;
+        creator.CommitMessageWrite(msg);
+    }
+    ASSERT_EQ(creator.GetMessageForWrite(), nullptr);
+    ASSERT_EQ(attached.GetMessageNumber(), 128U);
+    for (uint64_t i = 0; i < 128; ++i)
+    {
+        auto *msg = attached.GetMessageForRead();
+        ASSERT_TRUE(msg != nullptr);
+        ASSERT_EQ(msg->_id, i);
+        attached.CommitMessageRead(msg);
+    }
+    ASSERT_EQ(creator.GetMessageForRead(), nullptr);
+
+    ASSERT_TRUE(leopard::utils::ShmRingBuffer<ShmMessage>::Remove(name));
+    ASSERT_FALSE(leopard::utils::ShmRingBuffer<ShmMessage>::Remove(name));
+    // Mapped regions are still usable after removal.
+    auto *msg = creator.GetMessageForWrite();
+    ASSERT_TRUE(msg != nullptr);
+    creator.CommitMessageWrite(msg);
+    ASSERT_TRUE(attached.GetMessageForRead() != nullptr);
+}
+
+TEST(ShmRingBuffer, cross_process)
+{
+    auto name = std::string("leopard_shm_test_") + std::to_string(getpid());
+    leopard::utils::ShmRingBuffer<ShmMessage>::Remove(name);
+    constexpr uint64_t numMessages{100000};
+
+    auto pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        // Consumer process, attaches once the producer has created the region.
+        leopard::utils::ShmRingBuffer<ShmMessage> ring;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!ring.Attach(name))
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                _exit(2);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (uint64_t i = 0; i < numMessages; )
+        {
+            auto *msg = ring.GetMessageForRead();
+            if (!msg)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if ((msg->_id != i) || (msg->_checksum != i * 31 + 7) || (std::strcmp(msg->_text, "shm") != 0))
+            {
+                _exit(1);
+            }
+            ring.CommitMessageRead(msg);
+            ++i;
+        }
+        _exit(0);
+    }
+
+    leopard::utils::ShmRingBuffer<ShmMessage> ring;
+    ASSERT_TRUE(ring.Create(name, 1024, true));
+    for (uint64_t i = 0; i < numMessages; )
+    {
+        auto *msg = ring.GetMessageForWrite();
+        if (!msg)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        msg->_id = i;
+        msg->_checksum = i * 31 + 7;
+        std::strcpy(msg->_text, "shm");
+        ring.CommitMessageWrite(msg);
+        ++i;
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    leopard::utils::ShmRingBuffer<ShmMessage>::Remove(name);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+namespace
+{
+    struct FeedHeader
+    {
+        uint32_t _channel;
+        uint64_t _sequence;
+    } __attribute__((packed));
+
+    int OpenMulticastSender()
+    {
+        auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct in_addr loopback;
+        loopback.s_addr = htonl(INADDR_LOOPBACK);
+        int on = 1;
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+        return fd;
+    }
+
+    bool SendFeedPacket(int fd, const char *group, uint16_t port, uint32_t channel, uint64_t sequence, std::size_t size = 64)
+    {
+        std::vector<char> packet(std::max(size, sizeof(FeedHeader)));
+        FeedHeader header{channel, sequence};
+        std::memcpy(packet.data(), &header, sizeof(header));
+        std::memset(packet.data() + sizeof(header), static_cast<int>(sequence & 0xFF), packet.size() - sizeof(header));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, group, &addr.sin_addr);
+        return sendto(fd, packet.data(), packet.size(), 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))
+            == static_cast<ssize_t>(packet.size());
+    }
+
+    bool ParseFeedHeader(leopard::utils::UdpMulticastReceiver::Packet &packet)
+    {
+        if (packet._size < sizeof(FeedHeader))
+        {
+            return false;
+        }
+        FeedHeader header;
+        std::memcpy(&header, packet._data, sizeof(header));
+        packet._channel = header._channel;
+        packet._sequence = header._sequence;
+        return true;
+    }
+}
+
+TEST(UdpMulticastReceiver, callback_sequence_gaps)
+{
+    using leopard::utils::UdpMulticastReceiver;
+    UdpMulticastReceiver receiver("239.255.10.1", 0, "127.0.0.1", UdpMulticastReceiver::DEFAULT_BUFFER_SIZE, 4 * 1024 * 1024);
+    ASSERT_TRUE(receiver.JoinGroup("239.255.10.2"));
+    auto port = receiver.GetPort();
+    ASSERT_NE(port, 0);
+
+    struct Received
+    {
+        uint64_t _count{0};
+        uint64_t _stale_timestamps{0};
+        uint64_t _corrupted{0};
+        uint64_t _now_ns{0};
+    } received;
+    std::vector<std::array<uint64_t, 3>> gaps;
+
+    receiver.SetSequenceParser(&ParseFeedHeader);
+    receiver.SetGapCallback([&gaps](uint32_t channel, uint64_t expected, uint64_t sequence){
+        gaps.push_back({channel, expected, sequence});
+    });
+    receiver.SetPacketCallback([&received](const UdpMulticastReceiver::Packet &packet){
+        ++received._count;
+        if ((packet._kernel_ns == 0) || (packet._kernel_ns > received._now_ns + 1000000000ULL)
+            || (packet._kernel_ns + 60000000000ULL < received._now_ns))
+        {
+            ++received._stale_timestamps;
+        }
+        if ((packet._size != 64) || (static_cast<uint8_t>(packet._data[packet._size - 1]) != (packet._sequence & 0xFF)))
+        {
+            ++received._corrupted;
+        }
+    });
+
+    // Sent in chunks that fit in the effective socket buffer (capped by rmem_max), each one drained before
+    // the next so that the kernel drops none of them.
+    int receiveBuffer{0};
+    socklen_t len = sizeof(receiveBuffer);
+    ASSERT_EQ(getsockopt(receiver.GetFd(), SOL_SOCKET, SO_RCVBUF, &receiveBuffer, &len), 0);
+    uint64_t chunk = std::clamp<uint64_t>(static_cast<uint64_t>(receiveBuffer) / 2048, 1, UdpMulticastReceiver::BATCH_SIZE);
+
+    received._now_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    auto sender = OpenMulticastSender();
+    uint64_t sent{0};
+    uint64_t numChunks{0};
+    auto drain = [&](){
+        ++numChunks;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((receiver.GetPacketNumber() < sent) && (std::chrono::steady_clock::now() < deadline))
+        {
+            receiver.OnReadable();
+        }
+    };
+    auto send = [&](const char *group, uint32_t channel, uint64_t sequence){
+        sent += SendFeedPacket(sender, group, port, channel, sequence);
+        if (sent % chunk == 0)
+        {
+            drain();
+        }
+    };
+
+    // Channel 0 on the first group is complete, channel 1 on the second one misses 50-52 and repeats 10.
+    for (uint64_t i = 0; i < 200; ++i)
+    {
+        send("239.255.10.1", 0, i + 1000);
+        if ((i < 50) || (i > 52))
+        {
+            send("239.255.10.2", 1, i);
+        }
+        if (i == 100)
+        {
+            send("239.255.10.2", 1, 10);
+        }
+    }
+    drain();
+    close(sender);
+    ASSERT_EQ(sent, 398U);
+
+    ASSERT_EQ(receiver.GetPacketNumber(), sent);
+    ASSERT_EQ(received._count, sent);
+    ASSERT_EQ(received._stale_timestamps, 0U);
+    ASSERT_EQ(received._corrupted, 0U);
+    ASSERT_EQ(receiver.GetDropNumber(), 0U);
+    // Each chunk was queued before being drained, so it came in one batch, plus the call finding none left.
+    ASSERT_LE(receiver.GetSyscallNumber(), 2 * numChunks);
+
+    auto &channel0 = receiver.GetChannelStats(0);
+    ASSERT_EQ(channel0._packet_count, 200U);
+    ASSERT_EQ(channel0._next_sequence, 1200U);
+    ASSERT_EQ(channel0._gap_count, 0U);
+    auto &channel1 = receiver.GetChannelStats(1);
+    ASSERT_EQ(channel1._packet_count, 198U);
+    ASSERT_EQ(channel1._next_sequence, 200U);
+    ASSERT_EQ(channel1._gap_count, 1U);
+    ASSERT_EQ(channel1._lost_count, 3U);
+    ASSERT_EQ(channel1._late_count, 1U);
+    ASSERT_EQ(gaps.size(), 1U);
+    ASSERT_EQ(gaps[0], (std::array<uint64_t, 3>{1, 50, 53}));
+    std::cout << "Datagrams: " << receiver.GetPacketNumber() << ", recvmmsg calls: " << receiver.GetSyscallNumber()
+              << ", chunk: " << chunk << std::endl;
+}
+
+TEST(UdpMulticastReceiver, local_drops_reported_as_gap)
+{
+    using leopard::utils::UdpMulticastReceiver;
+    UdpMulticastReceiver receiver("239.255.10.4", 0, "127.0.0.1");
+    auto port = receiver.GetPort();
+    ASSERT_NE(port, 0);
+
+    leopard::utils::FixedSizePool pool;
+    ASSERT_TRUE(pool.Init(128, 256));
+    leopard::utils::MPMCRingBuffer<leopard::utils::UdpMessage> buff;
+    ASSERT_TRUE(buff.Init(8));
+    std::vector<std::array<uint64_t, 3>> gaps;
+    receiver.SetSequenceParser(&ParseFeedHeader);
+    receiver.SetGapCallback([&gaps](uint32_t channel, uint64_t expected, uint64_t sequence){
+        gaps.push_back({channel, expected, sequence});
+    });
+    receiver.SetRingBuffer(&buff, &pool);
+
+    // The ring-buffer takes the first 8, the next 12 are dropped.
+    auto sender = OpenMulticastSender();
+    for (uint64_t i = 0; i < 20; ++i)
+    {
+        ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.4", port, 0, i));
+    }
+    receiver.OnReadable();
+    ASSERT_EQ(receiver.GetPacketNumber(), 20U);
+    ASSERT_EQ(receiver.GetDropNumber(), 12U);
+    ASSERT_TRUE(gaps.empty());
+
+    for (uint64_t i = 0; i < 8; ++i)
+    {
+        auto *msg = buff.GetMessageForRead();
+        ASSERT_NE(msg, nullptr);
+        ASSERT_EQ(msg->_sequence, i);
+        pool.Deallocate(msg->_data_pointers[0]);
+        buff.CommitMessageRead(msg);
+    }
+
+    // The next delivered datagram reveals the ones dropped locally.
+    ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.4", port, 0, 20));
+    close(sender);
+    receiver.OnReadable();
+    auto &channel = receiver.GetChannelStats(0);
+    ASSERT_EQ(channel._packet_count, 9U);
+    ASSERT_EQ(channel._lost_count, 12U);
+    ASSERT_EQ(channel._next_sequence, 21U);
+    ASSERT_EQ(gaps.size(), 1U);
+    ASSERT_EQ(gaps[0], (std::array<uint64_t, 3>{0, 8, 20}));
+
+    auto *msg = buff.GetMessageForRead();
+    ASSERT_NE(msg, nullptr);
+    ASSERT_EQ(msg->_sequence, 20U);
+    pool.Deallocate(msg->_data_pointers[0]);
+    buff.CommitMessageRead(msg);
+}
+
+TEST(UdpMulticastReceiver, truncated_datagram_ring_buffer)
+{
+    using leopard::utils::UdpMulticastReceiver;
+    UdpMulticastReceiver receiver("239.255.10.5", 0, "127.0.0.1");
+    auto port = receiver.GetPort();
+    ASSERT_NE(port, 0);
+
+    leopard::utils::FixedSizePool pool;
+    ASSERT_TRUE(pool.Init(128, 256));
+    leopard::utils::MPMCRingBuffer<leopard::utils::UdpMessage> buff;
+    ASSERT_TRUE(buff.Init(8));
+    receiver.SetSequenceParser(&ParseFeedHeader);
+    receiver.SetRingBuffer(&buff, &pool);
+
+    // The second datagram is larger than a pool block.
+    auto sender = OpenMulticastSender();
+    ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.5", port, 0, 0));
+    ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.5", port, 0, 1, 256));
+    ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.5", port, 0, 2));
+    close(sender);
+    receiver.OnReadable();
+    ASSERT_EQ(receiver.GetPacketNumber(), 3U);
+    ASSERT_EQ(receiver.GetDropNumber(), 1U);
+
+    // Only the complete datagrams are published.
+    for (uint64_t sequence : {0, 2})
+    {
+        auto *msg = buff.GetMessageForRead();
+        ASSERT_NE(msg, nullptr);
+        ASSERT_EQ(msg->_data_pointers.size(), 1U);
+        ASSERT_EQ(msg->_sequence, sequence);
+        ASSERT_EQ(msg->_size, 64U);
+        pool.Deallocate(msg->_data_pointers[0]);
+        buff.CommitMessageRead(msg);
+    }
+    ASSERT_EQ(buff.GetMessageForRead(), nullptr);
+    ASSERT_EQ(receiver.GetChannelStats(0)._lost_count, 1U);
+}
+
+TEST(UdpMulticastReceiver, zero_copy_ring_buffer)
+{
+    using leopard::utils::UdpMulticastReceiver;
+    UdpMulticastReceiver receiver("239.255.10.3", 0, "127.0.0.1", UdpMulticastReceiver::DEFAULT_BUFFER_SIZE, 4 * 1024 * 1024);
+    auto port = receiver.GetPort();
+    ASSERT_NE(port, 0);
+
+    leopard::utils::FixedSizePool pool;
+    ASSERT_TRUE(pool.Init(128, 1024));
+    leopard::utils::MPMCRingBuffer<leopard::utils::UdpMessage> buff;
+    ASSERT_TRUE(buff.Init(256));
+    receiver.SetSequenceParser(&ParseFeedHeader);
+    receiver.SetRingBuffer(&buff, &pool);
+
+    leopard::utils::Reactor<leopard::utils::FdAggregator> reactor;
+    ASSERT_TRUE(reactor.AddFd(receiver.GetFd(), EPOLLIN, &receiver));
+    std::thread t([&](){ reactor.Run(); });
+
+    constexpr uint64_t numPackets{2000};
+    std::atomic<uint64_t> readCtr{0};
+    std::atomic<bool> corrupted{false};
+    std::thread consumer([&](){
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while ((readCtr.load() < numPackets) && (std::chrono::steady_clock::now() < deadline))
+        {
+            auto *msg = buff.GetMessageForRead();
+            if (!msg)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            auto *payload = msg->_data_pointers[0];
+            FeedHeader header;
+            std::memcpy(&header, payload, sizeof(header));
+            if ((msg->_data_pointers.size() != 1) || (msg->_size != 64) || (header._sequence != msg->_sequence)
+                || (msg->_sequence != readCtr.load()) || (msg->_kernel_ns == 0)
+                || (static_cast<uint8_t>(payload[msg->_size - 1]) != (msg->_sequence & 0xFF)))
+            {
+                corrupted = true;
+            }
+            pool.Deallocate(payload);
+            buff.CommitMessageRead(msg);
+            ++readCtr;
+        }
+    });
+
+    // Paced by the consumer, so that neither the socket buffer nor the ring-buffer overflows.
+    auto sender = OpenMulticastSender();
+    for (uint64_t i = 0; i < numPackets; ++i)
+    {
+        while (i >= readCtr.load() + 128)
+        {
+            std::this_thread::yield();
+        }
+        ASSERT_TRUE(SendFeedPacket(sender, "239.255.10.3", port, 0, i));
+    }
+    close(sender);
+    consumer.join();
+    reactor.Stop();
+    t.join();
+
+    ASSERT_EQ(readCtr.load(), numPackets);
+    ASSERT_FALSE(corrupted.load());
+    ASSERT_EQ(receiver.GetDropNumber(), 0U);
+    ASSERT_EQ(receiver.GetChannelStats(0)._gap_count, 0U);
+    ASSERT_LE(receiver.GetSyscallNumber(), receiver.GetPacketNumber() * 2);
+}